@@ -0,0 +1,336 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Benchmarks of the library on a host, at 10, 100 and 1000 objects: object
+ * creation, status and config publishing, MQTT command dispatch with per
+ * object and node-wide subscriptions, and automation evaluation. Each reports
+ * the time, heap allocations and published payload bytes per operation.
+ *
+ *   bench           full run
+ *   bench --quick   few operations, as a smoke test
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mgos.h"
+#include "mgos_homeassistant.h"
+#include "mgos_homeassistant_automation.h"
+#include "mgos_host.h"
+
+// Called by mos at boot, and not declared in a header.
+bool mgos_homeassistant_init(void);
+
+/* Allocation counting, as linked with -Wl,--wrap=malloc and friends. */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static uint64_t s_allocs = 0;
+
+void *__wrap_malloc(size_t size) {
+  s_allocs++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  s_allocs++;
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  s_allocs++;
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+  __real_free(ptr);
+}
+
+char *__wrap_strdup(const char *s) {
+  size_t len = strlen(s) + 1;
+  char *ret = __wrap_malloc(len);
+
+  if (ret) memcpy(ret, s, len);
+  return ret;
+}
+
+struct bench {
+  const char *name;
+  int objects;
+  uint64_t ops;
+  int64_t ns;
+  uint64_t allocs;
+  uint64_t bytes;
+
+  int64_t t0;
+  uint64_t allocs0;
+  uint64_t bytes0;
+};
+
+static int64_t bench_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t bench_published(void) {
+  struct mgos_host_mqtt_stats stats;
+
+  mgos_host_mqtt_get_stats(&stats);
+  return stats.bytes;
+}
+
+static void bench_start(struct bench *b, const char *name, int objects) {
+  memset(b, 0, sizeof(*b));
+  b->name = name;
+  b->objects = objects;
+}
+
+static void bench_resume(struct bench *b) {
+  b->allocs0 = s_allocs;
+  b->bytes0 = bench_published();
+  b->t0 = bench_now_ns();
+}
+
+static void bench_pause(struct bench *b, uint64_t ops) {
+  b->ns += bench_now_ns() - b->t0;
+  b->allocs += s_allocs - b->allocs0;
+  b->bytes += bench_published() - b->bytes0;
+  b->ops += ops;
+}
+
+static void bench_report(const struct bench *b) {
+  double ops = b->ops ? (double) b->ops : 1;
+
+  printf("%-20s %8d %10llu %12.1f %10.2f %10.1f\n", b->name, b->objects, (unsigned long long) b->ops, b->ns / ops, b->allocs / ops, b->bytes / ops);
+}
+
+/* The node under test */
+static uint32_t s_value = 0;
+static uint32_t s_cmds = 0;
+static int s_failed = 0;
+
+#define BENCH_CHECK(cond)                                                \
+  do {                                                                   \
+    if (!(cond)) {                                                       \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      s_failed++;                                                        \
+    }                                                                    \
+  } while (0)
+
+static void bench_status_cb(struct mgos_homeassistant_object *o, struct json_out *json) {
+  s_value++;
+  json_printf(json, "state:%Q,value:%u", s_value & 1 ? "ON" : "OFF", (unsigned) s_value);
+  (void) o;
+}
+
+static void bench_cmd_cb(struct mgos_homeassistant_object *o, const char *payload, const int payload_len) {
+  s_cmds++;
+  (void) o;
+  (void) payload;
+  (void) payload_len;
+}
+
+static void bench_clear(struct mgos_homeassistant *ha) {
+  while (!SLIST_EMPTY(&ha->automations)) {
+    struct mgos_homeassistant_automation *a = SLIST_FIRST(&ha->automations);
+    SLIST_REMOVE_HEAD(&ha->automations, entry);
+    mgos_homeassistant_automation_destroy(&a);
+  }
+  mgos_homeassistant_clear(ha);
+  mgos_host_advance(0);
+}
+
+static struct mgos_homeassistant_object *bench_add_object(struct mgos_homeassistant *ha, int i) {
+  char name[16];
+
+  snprintf(name, sizeof(name), "obj%d", i);
+  return mgos_homeassistant_object_add(ha, name, COMPONENT_SENSOR, NULL, bench_status_cb, NULL);
+}
+
+// Fills the node with n objects, and their configs sent.
+static void bench_fill(struct mgos_homeassistant *ha, int n, bool with_cmd) {
+  bench_clear(ha);
+  for (int i = 0; i < n; i++) {
+    struct mgos_homeassistant_object *o = bench_add_object(ha, i);
+    if (with_cmd) mgos_homeassistant_object_add_cmd_cb(o, NULL, bench_cmd_cb);
+  }
+  mgos_homeassistant_send_config(ha, true);
+}
+
+static void bench_object_add(struct mgos_homeassistant *ha, int n, uint64_t target) {
+  struct bench b;
+
+  bench_start(&b, "object_add", n);
+  do {
+    int added = 0;
+
+    bench_clear(ha);
+    bench_resume(&b);
+    for (int i = 0; i < n; i++) added += bench_add_object(ha, i) != NULL;
+    bench_pause(&b, n);
+    BENCH_CHECK(added == n);
+  } while (b.ops < target);
+  bench_report(&b);
+}
+
+static void bench_send_status(struct mgos_homeassistant *ha, int n, uint64_t target) {
+  struct mgos_homeassistant_object *o;
+  struct bench b;
+
+  bench_fill(ha, n, false);
+  // The first status of each object sizes its buffer.
+  SLIST_FOREACH(o, &ha->objects, entry) mgos_homeassistant_object_send_status(o);
+  bench_start(&b, "object_send_status", n);
+  do {
+    bench_resume(&b);
+    SLIST_FOREACH(o, &ha->objects, entry) mgos_homeassistant_object_send_status(o);
+    bench_pause(&b, n);
+  } while (b.ops < target);
+  BENCH_CHECK(b.bytes > 0);
+  bench_report(&b);
+}
+
+static void bench_send_config(struct mgos_homeassistant *ha, int n, uint64_t target) {
+  struct bench b;
+
+  bench_fill(ha, n, false);
+  bench_start(&b, "send_config", n);
+  do {
+    bench_resume(&b);
+    BENCH_CHECK(mgos_homeassistant_send_config(ha, true));
+    bench_pause(&b, 1);
+  } while (b.ops * n < target);
+  BENCH_CHECK(b.bytes > 0);
+  bench_report(&b);
+}
+
+static void bench_mqtt_dispatch(struct mgos_homeassistant *ha, int n, uint64_t target, bool node_subscription) {
+  char(*topics)[48] = malloc(n * sizeof(*topics));
+  struct bench b;
+  uint32_t cmds;
+
+  // Objects unsubscribe according to the setting at the time they are removed.
+  bench_clear(ha);
+  mgos_sys_config_set_homeassistant_node_subscription(node_subscription);
+  bench_fill(ha, n, true);
+  for (int i = 0; i < n; i++) snprintf(topics[i], sizeof(topics[i]), "%s/sensor/obj%d/cmd", ha->node_name, i);
+
+  bench_start(&b, node_subscription ? "mqtt_dispatch_node" : "mqtt_dispatch", n);
+  cmds = s_cmds;
+  do {
+    bench_resume(&b);
+    for (int i = 0; i < n; i++) mgos_host_mqtt_deliver(topics[i], "ON", 2);
+    bench_pause(&b, n);
+  } while (b.ops < target);
+  BENCH_CHECK(s_cmds - cmds == b.ops);
+  bench_report(&b);
+
+  bench_clear(ha);
+  mgos_sys_config_set_homeassistant_node_subscription(false);
+  free(topics);
+}
+
+// Every object has an automation that publishes when its state turns ON, with
+// a condition on its status. Statuses alternate between ON and OFF, and each
+// is evaluated as the status event of its object.
+static void bench_automation(struct mgos_homeassistant *ha, int n, uint64_t target) {
+  static const char *const statuses[] = {"{\"state\":\"OFF\"}", "{\"state\":\"ON\"}"};
+  struct mgos_homeassistant_object **objs = malloc(n * sizeof(*objs)), *o;
+  struct mgos_homeassistant_automation *a;
+  struct bench b;
+  struct mbuf json;
+  uint64_t round = 0;
+  int i = 0;
+
+  bench_fill(ha, n, false);
+  mbuf_init(&json, 0);
+  mbuf_append(&json, "{\"automation\":[", 15);
+  for (i = 0; i < n; i++) {
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf),
+                       "%s{\"trigger\":[{\"type\":\"status\",\"object\":\"obj%d\",\"status\":\"ON\"}],"
+                       "\"condition\":[{\"type\":\"status\",\"object\":\"obj%d\",\"status\":\"state\"}],"
+                       "\"action\":[{\"type\":\"mqtt\",\"topic\":\"bench/obj%d\",\"payload\":\"ON\"}]}",
+                       i ? "," : "", i, i, i);
+    mbuf_append(&json, buf, len);
+  }
+  mbuf_append(&json, "]}", 3);  // and a NUL
+  BENCH_CHECK(mgos_homeassistant_fromjson(ha, json.buf));
+  mbuf_free(&json);
+  i = 0;
+  SLIST_FOREACH(a, &ha->automations, entry) i++;
+  BENCH_CHECK(i == n);
+  i = 0;
+  SLIST_FOREACH(o, &ha->objects, entry) objs[i++] = o;
+
+  bench_start(&b, "automation", n);
+  do {
+    const char *status = statuses[round++ & 1];
+    size_t len = strlen(status);
+
+    bench_resume(&b);
+    for (i = 0; i < n; i++) {
+      objs[i]->status.len = 0;
+      mbuf_append(&objs[i]->status, status, len);
+      mgos_homeassistant_call_handlers(ha, MGOS_HOMEASSISTANT_EV_OBJECT_STATUS, objs[i]);
+    }
+    mgos_host_advance(0);
+    bench_pause(&b, n);
+  } while (b.ops < target || round < 2);
+  BENCH_CHECK(b.bytes > 0);
+  bench_report(&b);
+  free(objs);
+}
+
+int main(int argc, char **argv) {
+  static const int sizes[] = {10, 100, 1000};
+  struct mgos_homeassistant *ha;
+  uint64_t target = 20000;
+
+  if (argc > 1 && 0 == strcmp(argv[1], "--quick")) target = 100;
+
+  mgos_host_reset();
+  // Automation actions run as they are evaluated, not from the main loop.
+  mgos_sys_config_set_homeassistant_automation_queue_size(0);
+  if (!mgos_homeassistant_init() || !(ha = mgos_homeassistant_get_global())) {
+    fprintf(stderr, "Could not create node\n");
+    return 1;
+  }
+  mgos_host_mqtt_connect();
+  mgos_host_advance(1000);
+
+  printf("%-20s %8s %10s %12s %10s %10s\n", "benchmark", "objects", "ops", "ns/op", "allocs/op", "bytes/op");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    int n = sizes[i];
+
+    bench_object_add(ha, n, target);
+    bench_send_status(ha, n, target);
+    bench_send_config(ha, n, target);
+    bench_mqtt_dispatch(ha, n, target, false);
+    bench_automation(ha, n, target);
+  }
+  // Last, as the node subscription stays once made.
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) bench_mqtt_dispatch(ha, sizes[i], target, true);
+  bench_clear(ha);
+
+  if (s_failed) fprintf(stderr, "%d checks failed\n", s_failed);
+  return s_failed ? 1 : 0;
+}
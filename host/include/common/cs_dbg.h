@@ -0,0 +1,35 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/* Host stand-in for the SDK's common/cs_dbg.h: LOG() prints to stderr those
+ * messages at or below the level set with cs_log_set_level(), LL_ERROR unless
+ * set otherwise.
+ */
+
+enum cs_log_level { LL_NONE = -1, LL_ERROR = 0, LL_WARN = 1, LL_INFO = 2, LL_DEBUG = 3, LL_VERBOSE_DEBUG = 4 };
+
+void cs_log_set_level(enum cs_log_level level);
+int cs_log_print_prefix(enum cs_log_level level, const char *file, int line);
+void cs_log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#define LOG(l, x)                                         \
+  do {                                                    \
+    if (cs_log_print_prefix(l, __FILE__, __LINE__)) {     \
+      cs_log_printf x;                                    \
+    }                                                     \
+  } while (0)
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/* Host stand-in for the SDK's common/mbuf.h: a growable byte buffer. */
+
+#include <stddef.h>
+
+#ifndef MBUF_SIZE_MULTIPLIER
+#define MBUF_SIZE_MULTIPLIER 1.5
+#endif
+
+struct mbuf {
+  char *buf;
+  size_t len;
+  size_t size;
+};
+
+void mbuf_init(struct mbuf *mbuf, size_t initial_capacity);
+void mbuf_free(struct mbuf *mbuf);
+void mbuf_resize(struct mbuf *mbuf, size_t new_size);
+void mbuf_trim(struct mbuf *mbuf);
+size_t mbuf_insert(struct mbuf *mbuf, size_t off, const void *buf, size_t len);
+size_t mbuf_append(struct mbuf *mbuf, const void *buf, size_t len);
+void mbuf_remove(struct mbuf *mbuf, size_t n);
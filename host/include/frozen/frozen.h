@@ -0,0 +1,112 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/* Host stand-in for frozen, covering what this library uses: json_printf()
+ * with %Q, %.*Q, %B and the printf conversions, and unquoted keys; json_scanf()
+ * with %Q, %T, %B and the scanf conversions; json_walk(), json_next_key(),
+ * json_next_elem() and json_fread().
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum json_token_type {
+  JSON_TYPE_INVALID = 0,
+  JSON_TYPE_STRING,
+  JSON_TYPE_NUMBER,
+  JSON_TYPE_TRUE,
+  JSON_TYPE_FALSE,
+  JSON_TYPE_NULL,
+  JSON_TYPE_OBJECT_START,
+  JSON_TYPE_OBJECT_END,
+  JSON_TYPE_ARRAY_START,
+  JSON_TYPE_ARRAY_END,
+  JSON_TYPES_CNT
+};
+
+struct json_token {
+  const char *ptr;
+  int len;
+  enum json_token_type type;
+};
+
+#define JSON_INVALID_TOKEN \
+  { 0, 0, JSON_TYPE_INVALID }
+
+#define JSON_STRING_INVALID -1
+#define JSON_STRING_INCOMPLETE -2
+
+typedef void (*json_walk_callback_t)(void *callback_data, const char *name, size_t name_len, const char *path, const struct json_token *token);
+
+int json_walk(const char *json_string, int json_string_length, json_walk_callback_t callback, void *callback_data);
+
+struct json_out {
+  int (*printer)(struct json_out *, const char *str, size_t len);
+  union {
+    struct {
+      char *buf;
+      size_t size;
+      size_t len;
+    } buf;
+    void *data;
+    FILE *fp;
+  } u;
+};
+
+int json_printer_buf(struct json_out *, const char *, size_t);
+int json_printer_mbuf(struct json_out *, const char *, size_t);
+int json_printer_file(struct json_out *, const char *, size_t);
+
+#define JSON_OUT_BUF(buf, len) \
+  {                            \
+    json_printer_buf, {        \
+      { buf, len, 0 }          \
+    }                          \
+  }
+#define JSON_OUT_FILE(fp)   \
+  {                         \
+    json_printer_file, {    \
+      { (char *) fp, 0, 0 } \
+    }                       \
+  }
+#define JSON_OUT_MBUF(mb)   \
+  {                         \
+    json_printer_mbuf, {    \
+      { (char *) mb, 0, 0 } \
+    }                       \
+  }
+
+int json_printf(struct json_out *, const char *fmt, ...);
+int json_vprintf(struct json_out *, const char *fmt, va_list ap);
+
+int json_scanf(const char *str, int str_len, const char *fmt, ...);
+int json_vscanf(const char *str, int str_len, const char *fmt, va_list ap);
+
+char *json_fread(const char *file_name);
+
+void *json_next_key(const char *s, int len, void *handle, const char *path, struct json_token *key, struct json_token *val);
+void *json_next_elem(const char *s, int len, void *handle, const char *path, int *idx, struct json_token *val);
+
+#ifdef __cplusplus
+}
+#endif
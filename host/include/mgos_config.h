@@ -0,0 +1,57 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/* Host stand-in for the generated mgos_config.h, holding the settings of this
+ * library's mos.yml with the same defaults, and device.id. The getters and
+ * setters are generated from MGOS_HOST_CONFIG.
+ */
+
+#include <stdbool.h>
+
+#define MGOS_HOST_CONFIG(X)                                                 \
+  X(const char *, device_id, "host")                                        \
+  X(bool, homeassistant_enable, false)                                      \
+  X(const char *, homeassistant_config, "ha.conf")                          \
+  X(const char *, homeassistant_discovery_prefix, "ha")                     \
+  X(bool, homeassistant_node_subscription, false)                           \
+  X(int, homeassistant_status_max_silence, 0)                               \
+  X(int, homeassistant_status_coalesce_ms, 0)                               \
+  X(bool, homeassistant_aggregate_enable, false)                            \
+  X(const char *, homeassistant_aggregate_objects, "")                      \
+  X(int, homeassistant_arena_chunk_size, 0)                                 \
+  X(bool, homeassistant_diagnostics_enable, false)                          \
+  X(const char *, homeassistant_diagnostics_name, "diagnostics")            \
+  X(int, homeassistant_diagnostics_period, 60)                              \
+  X(int, homeassistant_offline_bytes, 0)                                    \
+  X(int, homeassistant_offline_samples, 1)                                  \
+  X(const char *, homeassistant_journal_file, "")                           \
+  X(int, homeassistant_journal_bytes, 16384)                                \
+  X(int, homeassistant_journal_batch, 8)                                    \
+  X(int, homeassistant_automation_queue_size, 0)                            \
+  X(int, homeassistant_automation_runs_per_tick, 4)                         \
+  X(int, homeassistant_automation_max_depth, 8)                             \
+  X(int, homeassistant_announce_interval_ms, 50)                            \
+  X(int, homeassistant_announce_msgs_per_tick, 0)                           \
+  X(int, homeassistant_announce_bytes_per_tick, 2048)                       \
+  X(int, homeassistant_announce_max_unsent, 2048)
+
+#define MGOS_HOST_CONFIG_DECLARE(type, name, dflt) \
+  type mgos_sys_config_get_##name(void);           \
+  void mgos_sys_config_set_##name(type v);
+MGOS_HOST_CONFIG(MGOS_HOST_CONFIG_DECLARE)
+#undef MGOS_HOST_CONFIG_DECLARE
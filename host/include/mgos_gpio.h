@@ -0,0 +1,43 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/* Host stand-in for the SDK's mgos_gpio.h. Pins hold the level last written,
+ * and mgos_host_gpio_input() calls the button handler of a pin.
+ */
+
+#include <stdbool.h>
+
+enum mgos_gpio_pull_type { MGOS_GPIO_PULL_NONE = 0, MGOS_GPIO_PULL_UP = 1, MGOS_GPIO_PULL_DOWN = 2 };
+enum mgos_gpio_int_mode {
+  MGOS_GPIO_INT_NONE = 0,
+  MGOS_GPIO_INT_EDGE_POS = 1,
+  MGOS_GPIO_INT_EDGE_NEG = 2,
+  MGOS_GPIO_INT_EDGE_ANY = 3,
+  MGOS_GPIO_INT_LEVEL_HI = 4,
+  MGOS_GPIO_INT_LEVEL_LO = 5
+};
+
+typedef void (*mgos_gpio_int_handler_f)(int pin, void *arg);
+
+bool mgos_gpio_set_button_handler(int pin, enum mgos_gpio_pull_type pull_type, enum mgos_gpio_int_mode int_mode, int debounce_ms,
+                                  mgos_gpio_int_handler_f cb, void *arg);
+bool mgos_gpio_setup_output(int pin, bool level);
+bool mgos_gpio_read(int pin);
+bool mgos_gpio_read_out(int pin);
+void mgos_gpio_write(int pin, bool level);
+bool mgos_gpio_toggle(int pin);
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/* Controls for the host stand-ins of mgos, MQTT and GPIO, for use by the
+ * benchmarks and tests that link the library on a host.
+ *
+ * mgos_host_reset();
+ * mgos_homeassistant_init();
+ * mgos_host_mqtt_connect();  // CONNACK, which starts the announcement
+ * mgos_host_advance(1000);   // runs the timers due in the next second
+ * mgos_host_mqtt_deliver("host/switch/relay/cmd", "ON", 2);
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mgos_host_mqtt_stats {
+  uint32_t msgs;   // messages published while connected
+  uint64_t bytes;  // payload bytes of those
+  uint32_t subs;   // current subscriptions
+};
+
+typedef void (*mgos_host_pub_cb)(const char *topic, const char *payload, size_t len, bool retain, void *user_data);
+
+// Resets the configuration to its defaults, the virtual clock to 0, clears all
+// timers, subscriptions, handlers and counters, and disconnects MQTT.
+void mgos_host_reset(void);
+
+// Moves the virtual clock ms milliseconds forward, running the timers that
+// become due on the way in order. mgos_host_advance(0) runs the timers that
+// are due now, including those they set for now.
+void mgos_host_advance(int ms);
+// Returns the number of timers set.
+int mgos_host_timers(void);
+
+// Connects MQTT: calls the connect function and the global handlers with
+// MG_EV_MQTT_CONNACK.
+void mgos_host_mqtt_connect(void);
+// Disconnects MQTT: calls the global handlers with MG_EV_CLOSE.
+void mgos_host_mqtt_disconnect(void);
+// Calls the handlers of the subscriptions matching topic, with MQTT wildcards,
+// and returns how many were called.
+int mgos_host_mqtt_deliver(const char *topic, const char *msg, int msg_len);
+void mgos_host_mqtt_set_unsent(size_t bytes);
+void mgos_host_mqtt_set_pub_cb(mgos_host_pub_cb cb, void *user_data);
+void mgos_host_mqtt_get_stats(struct mgos_host_mqtt_stats *stats);
+
+// Sets the input level of pin, calling its button handler if it changed.
+void mgos_host_gpio_input(int pin, bool level);
+
+#ifdef __cplusplus
+}
+#endif
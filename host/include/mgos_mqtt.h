@@ -0,0 +1,43 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/* Host stand-in for the mqtt library's mgos_mqtt.h. Messages are not sent
+ * anywhere; mgos_host.h has the calls to connect, deliver messages to the
+ * subscriptions and look at what was published.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mongoose.h"
+
+typedef void (*sub_handler_t)(struct mg_connection *nc, const char *topic, int topic_len, const char *msg, int msg_len, void *ud);
+typedef void (*mg_event_handler_t)(struct mg_connection *nc, int ev, void *ev_data, void *user_data);
+typedef void (*mgos_mqtt_connect_fn_t)(struct mg_connection *c, const char *client_id, struct mg_send_mqtt_handshake_opts *opts, void *fn_arg);
+
+void mgos_mqtt_sub(const char *topic, sub_handler_t, void *ud);
+bool mgos_mqtt_unsub(const char *topic);
+uint16_t mgos_mqtt_pub(const char *topic, const void *message, size_t len, int qos, bool retain);
+uint16_t mgos_mqtt_pubf(const char *topic, int qos, bool retain, const char *json_fmt, ...);
+uint16_t mgos_mqtt_pubv(const char *topic, int qos, bool retain, const char *json_fmt, va_list ap);
+bool mgos_mqtt_global_is_connected(void);
+void mgos_mqtt_add_global_handler(mg_event_handler_t handler, void *ud);
+void mgos_mqtt_set_connect_fn(mgos_mqtt_connect_fn_t cb, void *fn_arg);
+size_t mgos_mqtt_num_unsent_bytes(void);
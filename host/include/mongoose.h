@@ -0,0 +1,50 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/* Host stand-in for the parts of mongoose.h this library uses. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/mbuf.h"
+
+#define MG_EV_POLL 0
+#define MG_EV_CLOSE 5
+#define MG_EV_MQTT_CONNACK 202
+
+#define MG_MQTT_WILL_RETAIN 0x20
+
+struct mg_connection {
+  struct mbuf recv_mbuf;
+  struct mbuf send_mbuf;
+};
+
+struct mg_send_mqtt_handshake_opts {
+  unsigned char flags;
+  uint16_t keep_alive;
+  const char *will_topic;
+  const char *will_message;
+  const char *user_name;
+  const char *password;
+};
+
+void mg_send_mqtt_handshake_opt(struct mg_connection *nc, const char *client_id, struct mg_send_mqtt_handshake_opts opts);
+// Wall clock time in seconds.
+double mg_time(void);
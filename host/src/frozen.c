@@ -0,0 +1,679 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A small stand-in for frozen, good for what this library uses of it. It
+ * follows frozen's conventions: json_printf() quotes the bare identifiers of
+ * its format, so that "{name:%Q}" prints {"name":"..."}, and json_walk() calls
+ * back with frozen paths such as ".a.b[2]".
+ */
+
+#include "frozen/frozen.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/mbuf.h"
+
+#define JSON_MAX_PATH_LEN 256
+#define JSON_MAX_DEPTH 16
+
+/* Printing */
+int json_printer_buf(struct json_out *out, const char *buf, size_t len) {
+  size_t avail = out->u.buf.size > out->u.buf.len ? out->u.buf.size - out->u.buf.len - 1 : 0;
+  size_t n = len < avail ? len : avail;
+
+  if (n > 0) memcpy(out->u.buf.buf + out->u.buf.len, buf, n);
+  out->u.buf.len += n;
+  if (out->u.buf.size > 0) out->u.buf.buf[out->u.buf.len] = '\0';
+  return len;
+}
+
+int json_printer_mbuf(struct json_out *out, const char *buf, size_t len) {
+  mbuf_append((struct mbuf *) out->u.data, buf, len);
+  return len;
+}
+
+int json_printer_file(struct json_out *out, const char *buf, size_t len) {
+  return fwrite(buf, 1, len, out->u.fp);
+}
+
+static int json_print_quoted(struct json_out *out, const char *s, size_t len) {
+  const char *start = s;
+  int n = out->printer(out, "\"", 1);
+
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char) s[i];
+    const char *esc = NULL;
+    char buf[8];
+
+    switch (c) {
+      case '"':
+        esc = "\\\"";
+        break;
+      case '\\':
+        esc = "\\\\";
+        break;
+      case '\b':
+        esc = "\\b";
+        break;
+      case '\f':
+        esc = "\\f";
+        break;
+      case '\n':
+        esc = "\\n";
+        break;
+      case '\r':
+        esc = "\\r";
+        break;
+      case '\t':
+        esc = "\\t";
+        break;
+      default:
+        if (c < 0x20) {
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          esc = buf;
+        }
+    }
+    if (!esc) continue;
+    if (s + i > start) n += out->printer(out, start, s + i - start);
+    n += out->printer(out, esc, strlen(esc));
+    start = s + i + 1;
+  }
+  if (s + len > start) n += out->printer(out, start, s + len - start);
+  return n + out->printer(out, "\"", 1);
+}
+
+// Prints one printf conversion, whose value is v and whose '*' widths are
+// stars[0..nstars).
+#define JSON_PRINTF_CONV(T)                                                                          \
+  do {                                                                                               \
+    T v = va_arg(ap, T);                                                                             \
+    int need;                                                                                        \
+    if (nstars == 0)                                                                                 \
+      need = snprintf(buf, sizeof(buf), spec, v);                                                    \
+    else if (nstars == 1)                                                                            \
+      need = snprintf(buf, sizeof(buf), spec, stars[0], v);                                          \
+    else                                                                                             \
+      need = snprintf(buf, sizeof(buf), spec, stars[0], stars[1], v);                                \
+    if (need < 0) break;                                                                             \
+    if ((size_t) need < sizeof(buf)) {                                                               \
+      len += out->printer(out, buf, need);                                                           \
+      break;                                                                                         \
+    }                                                                                                \
+    char *big = malloc(need + 1);                                                                    \
+    if (!big) break;                                                                                 \
+    if (nstars == 0)                                                                                 \
+      snprintf(big, need + 1, spec, v);                                                              \
+    else if (nstars == 1)                                                                            \
+      snprintf(big, need + 1, spec, stars[0], v);                                                    \
+    else                                                                                             \
+      snprintf(big, need + 1, spec, stars[0], stars[1], v);                                          \
+    len += out->printer(out, big, need);                                                             \
+    free(big);                                                                                       \
+  } while (0)
+
+int json_vprintf(struct json_out *out, const char *fmt, va_list xap) {
+  va_list ap;
+  int len = 0;
+
+  va_copy(ap, xap);
+  while (*fmt) {
+    if (strchr(":, \r\n\t[]{}\"", *fmt)) {
+      len += out->printer(out, fmt, 1);
+      fmt++;
+    } else if (*fmt == '%') {
+      char spec[32], lenmod[3] = {0}, buf[64];
+      size_t sl = 0;
+      int stars[2], nstars = 0, precision = -1;
+      char conv;
+
+      fmt++;
+      if (*fmt == '%') {
+        len += out->printer(out, "%", 1);
+        fmt++;
+        continue;
+      }
+      spec[sl++] = '%';
+      while (*fmt && strchr("-+ #0", *fmt) && sl < 8) spec[sl++] = *fmt++;
+      if (*fmt == '*') {
+        stars[nstars++] = va_arg(ap, int);
+        spec[sl++] = *fmt++;
+      } else {
+        while (isdigit((int) *fmt) && sl < 16) spec[sl++] = *fmt++;
+      }
+      if (*fmt == '.') {
+        spec[sl++] = *fmt++;
+        if (*fmt == '*') {
+          precision = stars[nstars++] = va_arg(ap, int);
+          spec[sl++] = *fmt++;
+        } else {
+          precision = atoi(fmt);
+          while (isdigit((int) *fmt) && sl < 24) spec[sl++] = *fmt++;
+        }
+      }
+      for (int i = 0; i < 2 && *fmt && strchr("hlLzjt", *fmt); i++) lenmod[i] = spec[sl++] = *fmt++;
+      conv = *fmt;
+      if (!conv) break;
+      fmt++;
+      spec[sl++] = conv;
+      spec[sl] = '\0';
+
+      switch (conv) {
+        case 'Q': {
+          const char *s = va_arg(ap, const char *);
+          if (!s)
+            len += out->printer(out, "null", 4);
+          else
+            len += json_print_quoted(out, s, precision >= 0 ? (size_t) precision : strlen(s));
+          break;
+        }
+        case 'B': {
+          int b = va_arg(ap, int);
+          len += b ? out->printer(out, "true", 4) : out->printer(out, "false", 5);
+          break;
+        }
+        case 's':
+          JSON_PRINTF_CONV(const char *);
+          break;
+        case 'p':
+          JSON_PRINTF_CONV(void *);
+          break;
+        case 'c':
+          JSON_PRINTF_CONV(int);
+          break;
+        case 'd':
+        case 'i':
+          if (!strcmp(lenmod, "ll"))
+            JSON_PRINTF_CONV(long long);
+          else if (!strcmp(lenmod, "l"))
+            JSON_PRINTF_CONV(long);
+          else if (!strcmp(lenmod, "z"))
+            JSON_PRINTF_CONV(size_t);
+          else
+            JSON_PRINTF_CONV(int);
+          break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+          if (!strcmp(lenmod, "ll"))
+            JSON_PRINTF_CONV(unsigned long long);
+          else if (!strcmp(lenmod, "l"))
+            JSON_PRINTF_CONV(unsigned long);
+          else if (!strcmp(lenmod, "z"))
+            JSON_PRINTF_CONV(size_t);
+          else
+            JSON_PRINTF_CONV(unsigned int);
+          break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+          if (!strcmp(lenmod, "L"))
+            JSON_PRINTF_CONV(long double);
+          else
+            JSON_PRINTF_CONV(double);
+          break;
+        default:
+          // %M and friends are not supported, and the arguments cannot be skipped.
+          va_end(ap);
+          return len;
+      }
+    } else if (isalpha((int) *fmt) || *fmt == '_') {
+      const char *end = fmt;
+      while (isalnum((int) *end) || *end == '_') end++;
+      len += out->printer(out, "\"", 1);
+      len += out->printer(out, fmt, end - fmt);
+      len += out->printer(out, "\"", 1);
+      fmt = end;
+    } else {
+      len += out->printer(out, fmt, 1);
+      fmt++;
+    }
+  }
+  va_end(ap);
+  return len;
+}
+
+int json_printf(struct json_out *out, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = json_vprintf(out, fmt, ap);
+  va_end(ap);
+  return n;
+}
+
+/* Walking */
+struct json_walker {
+  const char *cur;
+  const char *end;
+  json_walk_callback_t cb;
+  void *cb_data;
+  char path[JSON_MAX_PATH_LEN];
+  size_t path_len;
+  int depth;
+};
+
+static int json_peek(struct json_walker *w) {
+  while (w->cur < w->end && isspace((int) *w->cur)) w->cur++;
+  return w->cur < w->end ? (unsigned char) *w->cur : -1;
+}
+
+static void json_callback(struct json_walker *w, const char *name, size_t name_len, const char *ptr, int len, enum json_token_type type) {
+  struct json_token t;
+
+  if (!w->cb) return;
+  t.ptr = ptr;
+  t.len = len;
+  t.type = type;
+  w->cb(w->cb_data, name, name_len, w->path, &t);
+}
+
+// Parses the string at w->cur, returning its contents without the quotes.
+static int json_parse_string(struct json_walker *w, const char **ptr, int *len) {
+  const char *p = w->cur + 1;
+
+  while (p < w->end && *p != '"') {
+    if (*p == '\\' && ++p >= w->end) break;
+    p++;
+  }
+  if (p >= w->end) return JSON_STRING_INCOMPLETE;
+  *ptr = w->cur + 1;
+  *len = p - *ptr;
+  w->cur = p + 1;
+  return 0;
+}
+
+static bool json_path_append(struct json_walker *w, const char *fmt, int len, const char *s) {
+  int n = snprintf(w->path + w->path_len, sizeof(w->path) - w->path_len, fmt, len, s);
+  if (n < 0 || (size_t) n >= sizeof(w->path) - w->path_len) return false;
+  w->path_len += n;
+  return true;
+}
+
+static int json_walk_value(struct json_walker *w, const char *name, size_t name_len) {
+  const char *start, *ptr;
+  size_t saved = w->path_len;
+  int c = json_peek(w), len, ret;
+
+  if (c < 0) return JSON_STRING_INCOMPLETE;
+  start = w->cur;
+
+  if (c == '"') {
+    if ((ret = json_parse_string(w, &ptr, &len)) < 0) return ret;
+    json_callback(w, name, name_len, ptr, len, JSON_TYPE_STRING);
+  } else if (c == '{' || c == '[') {
+    bool object = c == '{';
+    int idx = 0;
+
+    if (++w->depth > JSON_MAX_DEPTH) return JSON_STRING_INVALID;
+    json_callback(w, name, name_len, start, 1, object ? JSON_TYPE_OBJECT_START : JSON_TYPE_ARRAY_START);
+    w->cur++;
+    if (json_peek(w) == (object ? '}' : ']')) {
+      w->cur++;
+    } else {
+      for (;;) {
+        const char *key = NULL;
+        char idx_buf[12];
+        int key_len = 0;
+
+        if (object) {
+          c = json_peek(w);
+          if (c == '"') {
+            if ((ret = json_parse_string(w, &key, &key_len)) < 0) return ret;
+          } else if (c >= 0 && (isalpha(c) || c == '_')) {
+            key = w->cur;
+            while (w->cur < w->end && (isalnum((int) *w->cur) || *w->cur == '_')) w->cur++;
+            key_len = w->cur - key;
+          } else {
+            return c < 0 ? JSON_STRING_INCOMPLETE : JSON_STRING_INVALID;
+          }
+          if (!json_path_append(w, ".%.*s", key_len, key)) return JSON_STRING_INVALID;
+          if ((c = json_peek(w)) != ':') return c < 0 ? JSON_STRING_INCOMPLETE : JSON_STRING_INVALID;
+          w->cur++;
+        } else {
+          snprintf(idx_buf, sizeof(idx_buf), "%d", idx++);
+          key = w->path + w->path_len + 1;
+          key_len = strlen(idx_buf);
+          if (!json_path_append(w, "[%.*s]", key_len, idx_buf)) return JSON_STRING_INVALID;
+        }
+        if ((ret = json_walk_value(w, key, key_len)) < 0) return ret;
+        w->path_len = saved;
+        w->path[saved] = '\0';
+
+        c = json_peek(w);
+        if (c == ',') {
+          w->cur++;
+          continue;
+        }
+        if (c == (object ? '}' : ']')) {
+          w->cur++;
+          break;
+        }
+        return c < 0 ? JSON_STRING_INCOMPLETE : JSON_STRING_INVALID;
+      }
+    }
+    w->depth--;
+    json_callback(w, name, name_len, start, w->cur - start, object ? JSON_TYPE_OBJECT_END : JSON_TYPE_ARRAY_END);
+  } else if (c == '-' || isdigit(c)) {
+    w->cur++;
+    while (w->cur < w->end && (isdigit((int) *w->cur) || strchr(".eE+-", *w->cur))) w->cur++;
+    json_callback(w, name, name_len, start, w->cur - start, JSON_TYPE_NUMBER);
+  } else {
+    static const struct {
+      const char *s;
+      enum json_token_type type;
+    } literals[] = {{"true", JSON_TYPE_TRUE}, {"false", JSON_TYPE_FALSE}, {"null", JSON_TYPE_NULL}};
+    size_t i;
+
+    for (i = 0; i < sizeof(literals) / sizeof(literals[0]); i++) {
+      size_t n = strlen(literals[i].s);
+      if ((size_t)(w->end - w->cur) < n || strncmp(w->cur, literals[i].s, n)) continue;
+      w->cur += n;
+      json_callback(w, name, name_len, start, n, literals[i].type);
+      break;
+    }
+    if (i == sizeof(literals) / sizeof(literals[0])) return JSON_STRING_INVALID;
+  }
+  return 0;
+}
+
+int json_walk(const char *json_string, int json_string_length, json_walk_callback_t callback, void *callback_data) {
+  struct json_walker w;
+  int ret;
+
+  if (!json_string || json_string_length < 0) return JSON_STRING_INVALID;
+  memset(&w, 0, sizeof(w));
+  w.cur = json_string;
+  w.end = json_string + json_string_length;
+  w.cb = callback;
+  w.cb_data = callback_data;
+  if ((ret = json_walk_value(&w, NULL, 0)) < 0) return ret;
+  return w.cur - json_string;
+}
+
+/* Scanning */
+struct json_scanf_find {
+  const char *path;
+  struct json_token token;
+  bool found;
+};
+
+static void json_scanf_find_cb(void *callback_data, const char *name, size_t name_len, const char *path, const struct json_token *token) {
+  struct json_scanf_find *f = (struct json_scanf_find *) callback_data;
+
+  if (f->found || token->type == JSON_TYPE_OBJECT_START || token->type == JSON_TYPE_ARRAY_START) return;
+  if (strcmp(path, f->path)) return;
+  f->token = *token;
+  f->found = true;
+  (void) name;
+  (void) name_len;
+}
+
+static int json_hex(const char *s) {
+  int v = 0;
+
+  for (int i = 0; i < 4; i++) {
+    int c = tolower((int) s[i]);
+    if (!isxdigit(c)) return -1;
+    v = v * 16 + (isdigit(c) ? c - '0' : c - 'a' + 10);
+  }
+  return v;
+}
+
+// Returns a NUL terminated, unescaped copy of a string token.
+static char *json_unescape(const char *s, int len) {
+  char *ret = malloc(len + 1), *d = ret;
+  const char *end = s + len;
+
+  if (!ret) return NULL;
+  while (s < end) {
+    if (*s != '\\' || s + 1 >= end) {
+      *d++ = *s++;
+      continue;
+    }
+    s++;
+    switch (*s) {
+      case 'b':
+        *d++ = '\b';
+        break;
+      case 'f':
+        *d++ = '\f';
+        break;
+      case 'n':
+        *d++ = '\n';
+        break;
+      case 'r':
+        *d++ = '\r';
+        break;
+      case 't':
+        *d++ = '\t';
+        break;
+      case 'u': {
+        int cp = s + 4 < end ? json_hex(s + 1) : -1;
+        if (cp < 0) {
+          *d++ = 'u';
+          break;
+        }
+        s += 4;
+        if (cp < 0x80) {
+          *d++ = cp;
+        } else if (cp < 0x800) {
+          *d++ = 0xc0 | (cp >> 6);
+          *d++ = 0x80 | (cp & 0x3f);
+        } else {
+          *d++ = 0xe0 | (cp >> 12);
+          *d++ = 0x80 | ((cp >> 6) & 0x3f);
+          *d++ = 0x80 | (cp & 0x3f);
+        }
+        break;
+      }
+      default:
+        *d++ = *s;
+    }
+    s++;
+  }
+  *d = '\0';
+  return ret;
+}
+
+static bool json_scanf_conv(const struct json_token *t, const char *spec, char conv, void *target) {
+  char buf[64];
+
+  switch (conv) {
+    case 'Q':
+      if (t->type == JSON_TYPE_NULL) {
+        *(char **) target = NULL;
+        return true;
+      }
+      return (*(char **) target = json_unescape(t->ptr, t->len)) != NULL;
+    case 'T':
+      *(struct json_token *) target = *t;
+      return true;
+    case 'B':
+      if (t->type != JSON_TYPE_TRUE && t->type != JSON_TYPE_FALSE) return false;
+      *(bool *) target = t->type == JSON_TYPE_TRUE;
+      return true;
+    default:
+      if (t->len <= 0 || t->len >= (int) sizeof(buf)) return false;
+      memcpy(buf, t->ptr, t->len);
+      buf[t->len] = '\0';
+      return sscanf(buf, spec, target) == 1;
+  }
+}
+
+int json_vscanf(const char *str, int str_len, const char *fmt, va_list xap) {
+  char path[JSON_MAX_PATH_LEN];
+  size_t path_len = 0, key_start = 0, stack[JSON_MAX_DEPTH];
+  int depth = 0, n = 0;
+  bool have_key = false;
+  va_list ap;
+
+  path[0] = '\0';
+  va_copy(ap, xap);
+  while (*fmt) {
+    if (*fmt == '{') {
+      if (depth < JSON_MAX_DEPTH) stack[depth++] = have_key ? key_start : path_len;
+      have_key = false;
+      fmt++;
+    } else if (*fmt == '}') {
+      if (depth > 0) path_len = stack[--depth];
+      path[path_len] = '\0';
+      have_key = false;
+      fmt++;
+    } else if (*fmt == '%') {
+      struct json_scanf_find f;
+      char spec[16];
+      size_t sl = 0;
+      void *target;
+
+      spec[sl++] = *fmt++;
+      while (*fmt && strchr("0123456789hlLzjt", *fmt) && sl < sizeof(spec) - 2) spec[sl++] = *fmt++;
+      if (!*fmt) break;
+      spec[sl++] = *fmt;
+      spec[sl] = '\0';
+      target = va_arg(ap, void *);
+
+      memset(&f, 0, sizeof(f));
+      f.path = path;
+      if (json_walk(str, str_len, json_scanf_find_cb, &f) >= 0 && f.found && json_scanf_conv(&f.token, spec, *fmt, target)) n++;
+      fmt++;
+      path_len = key_start;
+      path[path_len] = '\0';
+      have_key = false;
+    } else if (*fmt == '"' || isalpha((int) *fmt) || *fmt == '_') {
+      const char *key = fmt;
+      size_t key_len;
+      int len;
+
+      if (*fmt == '"') {
+        key = ++fmt;
+        while (*fmt && *fmt != '"') fmt++;
+        key_len = fmt - key;
+        if (*fmt) fmt++;
+      } else {
+        while (isalnum((int) *fmt) || *fmt == '_') fmt++;
+        key_len = fmt - key;
+      }
+      key_start = path_len;
+      len = snprintf(path + path_len, sizeof(path) - path_len, ".%.*s", (int) key_len, key);
+      if (len > 0 && (size_t) len < sizeof(path) - path_len) path_len += len;
+      have_key = true;
+    } else {
+      fmt++;
+    }
+  }
+  va_end(ap);
+  return n;
+}
+
+int json_scanf(const char *str, int str_len, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = json_vscanf(str, str_len, fmt, ap);
+  va_end(ap);
+  return n;
+}
+
+/* Iterating */
+struct json_next_find {
+  const char *prefix;
+  size_t prefix_len;
+  const char *after;  // end of the previous element, NULL for the first
+  bool keys;
+  bool found;
+  int idx;
+  struct json_token key;
+  struct json_token val;
+};
+
+static void json_next_find_cb(void *callback_data, const char *name, size_t name_len, const char *path, const struct json_token *token) {
+  struct json_next_find *f = (struct json_next_find *) callback_data;
+  const char *rest;
+
+  if (f->found || token->type == JSON_TYPE_OBJECT_START || token->type == JSON_TYPE_ARRAY_START) return;
+  if (strncmp(path, f->prefix, f->prefix_len)) return;
+  rest = path + f->prefix_len;
+  // Only direct children of the prefix.
+  if (f->keys) {
+    if (rest[0] != '.' || strpbrk(rest + 1, ".[")) return;
+  } else {
+    if (rest[0] != '[') return;
+    rest++;
+    while (isdigit((int) *rest)) rest++;
+    if (rest[0] != ']' || rest[1] != '\0') return;
+  }
+  if (f->after && token->ptr <= f->after) {
+    f->idx++;
+    return;
+  }
+  f->found = true;
+  f->key.ptr = name;
+  f->key.len = name_len;
+  f->key.type = JSON_TYPE_STRING;
+  f->val = *token;
+}
+
+static void *json_next(const char *s, int len, void *handle, const char *path, bool keys, struct json_token *key, struct json_token *val,
+                       int *idx) {
+  struct json_next_find f;
+
+  memset(&f, 0, sizeof(f));
+  f.prefix = path ? path : "";
+  f.prefix_len = strlen(f.prefix);
+  f.after = (const char *) handle;
+  f.keys = keys;
+  if (json_walk(s, len, json_next_find_cb, &f) < 0 || !f.found) return NULL;
+  if (key) *key = f.key;
+  if (val) *val = f.val;
+  if (idx) *idx = f.idx;
+  return (void *) (f.val.ptr + f.val.len);
+}
+
+void *json_next_key(const char *s, int len, void *handle, const char *path, struct json_token *key, struct json_token *val) {
+  return json_next(s, len, handle, path, true, key, val, NULL);
+}
+
+void *json_next_elem(const char *s, int len, void *handle, const char *path, int *idx, struct json_token *val) {
+  return json_next(s, len, handle, path, false, NULL, val, idx);
+}
+
+char *json_fread(const char *file_name) {
+  FILE *fp;
+  char *data = NULL;
+  long size;
+
+  if (!(fp = fopen(file_name, "rb"))) return NULL;
+  if (0 == fseek(fp, 0, SEEK_END) && (size = ftell(fp)) >= 0 && 0 == fseek(fp, 0, SEEK_SET) && (data = malloc(size + 1))) {
+    if (fread(data, 1, size, fp) != (size_t) size) {
+      free(data);
+      data = NULL;
+    } else {
+      data[size] = '\0';
+    }
+  }
+  fclose(fp);
+  return data;
+}
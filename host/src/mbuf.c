@@ -0,0 +1,85 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/mbuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void mbuf_init(struct mbuf *mbuf, size_t initial_capacity) {
+  mbuf->len = mbuf->size = 0;
+  mbuf->buf = NULL;
+  mbuf_resize(mbuf, initial_capacity);
+}
+
+void mbuf_free(struct mbuf *mbuf) {
+  if (mbuf->buf != NULL) free(mbuf->buf);
+  mbuf->buf = NULL;
+  mbuf->len = mbuf->size = 0;
+}
+
+void mbuf_resize(struct mbuf *mbuf, size_t new_size) {
+  char *buf;
+
+  if (new_size <= mbuf->size || (new_size == 0 && mbuf->size == 0)) {
+    if (new_size >= mbuf->len && new_size < mbuf->size) {
+      // Shrinking, as mbuf_trim() does.
+      if (new_size == 0) {
+        mbuf_free(mbuf);
+        return;
+      }
+      if ((buf = realloc(mbuf->buf, new_size))) {
+        mbuf->buf = buf;
+        mbuf->size = new_size;
+      }
+    }
+    return;
+  }
+  if ((buf = realloc(mbuf->buf, new_size))) {
+    mbuf->buf = buf;
+    mbuf->size = new_size;
+  }
+}
+
+void mbuf_trim(struct mbuf *mbuf) {
+  mbuf_resize(mbuf, mbuf->len);
+}
+
+size_t mbuf_insert(struct mbuf *a, size_t off, const void *buf, size_t len) {
+  if (off > a->len) return 0;
+  if (a->len + len > a->size) {
+    size_t new_size = (size_t)((a->len + len) * MBUF_SIZE_MULTIPLIER);
+    char *p = realloc(a->buf, new_size);
+    if (!p) return 0;
+    a->buf = p;
+    a->size = new_size;
+  }
+  if (a->len > off) memmove(a->buf + off + len, a->buf + off, a->len - off);
+  if (buf != NULL && len > 0) memcpy(a->buf + off, buf, len);
+  a->len += len;
+  return len;
+}
+
+size_t mbuf_append(struct mbuf *a, const void *buf, size_t len) {
+  return mbuf_insert(a, a->len, buf, len);
+}
+
+void mbuf_remove(struct mbuf *mb, size_t n) {
+  if (n > 0 && n <= mb->len) {
+    memmove(mb->buf, mb->buf + n, mb->len - n);
+    mb->len -= n;
+  }
+}
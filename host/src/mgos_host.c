@@ -0,0 +1,438 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos_host.h"
+
+#include <stdarg.h>
+
+#include "mgos.h"
+#include "mgos_gpio.h"
+#include "mgos_mqtt.h"
+#include "mgos_ro_vars.h"
+
+/* Configuration */
+#define MGOS_HOST_CONFIG_DEFINE(type, name, dflt) \
+  static type s_##name = dflt;                    \
+  type mgos_sys_config_get_##name(void) {         \
+    return s_##name;                              \
+  }                                               \
+  void mgos_sys_config_set_##name(type v) {       \
+    s_##name = v;                                 \
+  }
+MGOS_HOST_CONFIG(MGOS_HOST_CONFIG_DEFINE)
+#undef MGOS_HOST_CONFIG_DEFINE
+
+static void mgos_host_config_reset(void) {
+#define MGOS_HOST_CONFIG_RESET(type, name, dflt) s_##name = dflt;
+  MGOS_HOST_CONFIG(MGOS_HOST_CONFIG_RESET)
+#undef MGOS_HOST_CONFIG_RESET
+}
+
+const char *mgos_sys_ro_vars_get_mac_address(void) {
+  return "0200C0FFEE00";
+}
+
+const char *mgos_sys_ro_vars_get_app(void) {
+  return "homeassistant-host";
+}
+
+const char *mgos_sys_ro_vars_get_fw_version(void) {
+  return "1.0";
+}
+
+const char *mgos_sys_ro_vars_get_fw_id(void) {
+  return "host";
+}
+
+size_t mgos_get_free_heap_size(void) {
+  return 0;
+}
+
+/* Logging */
+static enum cs_log_level s_log_level = LL_ERROR;
+
+void cs_log_set_level(enum cs_log_level level) {
+  s_log_level = level;
+}
+
+int cs_log_print_prefix(enum cs_log_level level, const char *file, int line) {
+  const char *p;
+
+  if (level > s_log_level) return 0;
+  if ((p = strrchr(file, '/'))) file = p + 1;
+  fprintf(stderr, "%s:%d ", file, line);
+  return 1;
+}
+
+void cs_log_printf(const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
+
+/* Timers, on a virtual clock */
+struct mgos_host_timer {
+  mgos_timer_id id;
+  int64_t due;  // microseconds
+  int64_t interval;
+  timer_callback cb;
+  void *cb_arg;
+  SLIST_ENTRY(mgos_host_timer) entry;
+};
+
+static SLIST_HEAD(, mgos_host_timer) s_timers = SLIST_HEAD_INITIALIZER(s_timers);
+static mgos_timer_id s_timer_id = 0;
+static int64_t s_now = 0;
+static time_t s_wall;
+
+mgos_timer_id mgos_set_timer(int msecs, int flags, timer_callback cb, void *cb_arg) {
+  struct mgos_host_timer *t;
+
+  if (!cb || !(t = calloc(1, sizeof(*t)))) return MGOS_INVALID_TIMER_ID;
+  if (msecs < 0) msecs = 0;
+  t->id = ++s_timer_id;
+  t->due = s_now + (int64_t) msecs * 1000;
+  // A repeating timer of 0ms would never let the clock move.
+  if (flags & MGOS_TIMER_REPEAT) t->interval = msecs > 0 ? (int64_t) msecs * 1000 : 1000;
+  t->cb = cb;
+  t->cb_arg = cb_arg;
+  SLIST_INSERT_HEAD(&s_timers, t, entry);
+  return t->id;
+}
+
+void mgos_clear_timer(mgos_timer_id id) {
+  struct mgos_host_timer *t;
+
+  if (id == MGOS_INVALID_TIMER_ID) return;
+  SLIST_FOREACH(t, &s_timers, entry) {
+    if (t->id != id) continue;
+    SLIST_REMOVE(&s_timers, t, mgos_host_timer, entry);
+    free(t);
+    return;
+  }
+}
+
+double mgos_uptime(void) {
+  return s_now / 1e6;
+}
+
+int64_t mgos_uptime_micros(void) {
+  return s_now;
+}
+
+double mg_time(void) {
+  return (double) s_wall + s_now / 1e6;
+}
+
+int mgos_host_timers(void) {
+  struct mgos_host_timer *t;
+  int n = 0;
+
+  SLIST_FOREACH(t, &s_timers, entry) n++;
+  return n;
+}
+
+void mgos_host_advance(int ms) {
+  int64_t until = s_now + (int64_t) ms * 1000;
+
+  for (;;) {
+    struct mgos_host_timer *t, *first = NULL;
+    timer_callback cb;
+    void *cb_arg;
+
+    // Earliest first, and of those the one set first.
+    SLIST_FOREACH(t, &s_timers, entry) {
+      if (t->due <= until && (!first || t->due < first->due || (t->due == first->due && t->id < first->id))) first = t;
+    }
+    if (!first) break;
+    if (first->due > s_now) s_now = first->due;
+    cb = first->cb;
+    cb_arg = first->cb_arg;
+    if (first->interval > 0) {
+      first->due += first->interval;
+    } else {
+      SLIST_REMOVE(&s_timers, first, mgos_host_timer, entry);
+      free(first);
+    }
+    cb(cb_arg);
+  }
+  s_now = until;
+}
+
+/* MQTT */
+struct mgos_host_sub {
+  char *topic;
+  sub_handler_t handler;
+  void *ud;
+  SLIST_ENTRY(mgos_host_sub) entry;
+};
+
+struct mgos_host_global_handler {
+  mg_event_handler_t handler;
+  void *ud;
+  SLIST_ENTRY(mgos_host_global_handler) entry;
+};
+
+static SLIST_HEAD(, mgos_host_sub) s_subs = SLIST_HEAD_INITIALIZER(s_subs);
+static SLIST_HEAD(, mgos_host_global_handler) s_handlers = SLIST_HEAD_INITIALIZER(s_handlers);
+static mgos_mqtt_connect_fn_t s_connect_fn = NULL;
+static void *s_connect_fn_arg = NULL;
+static struct mg_connection s_conn;
+static bool s_connected = false;
+static size_t s_unsent = 0;
+static uint16_t s_packet_id = 0;
+static struct mgos_host_mqtt_stats s_mqtt_stats;
+static mgos_host_pub_cb s_pub_cb = NULL;
+static void *s_pub_cb_ud = NULL;
+
+void mgos_mqtt_sub(const char *topic, sub_handler_t handler, void *ud) {
+  struct mgos_host_sub *s;
+
+  if (!topic || !handler || !(s = calloc(1, sizeof(*s)))) return;
+  if (!(s->topic = strdup(topic))) {
+    free(s);
+    return;
+  }
+  s->handler = handler;
+  s->ud = ud;
+  SLIST_INSERT_HEAD(&s_subs, s, entry);
+  s_mqtt_stats.subs++;
+}
+
+bool mgos_mqtt_unsub(const char *topic) {
+  struct mgos_host_sub *s;
+
+  if (!topic) return false;
+  SLIST_FOREACH(s, &s_subs, entry) {
+    if (strcmp(s->topic, topic)) continue;
+    SLIST_REMOVE(&s_subs, s, mgos_host_sub, entry);
+    free(s->topic);
+    free(s);
+    s_mqtt_stats.subs--;
+    return true;
+  }
+  return false;
+}
+
+uint16_t mgos_mqtt_pub(const char *topic, const void *message, size_t len, int qos, bool retain) {
+  if (!s_connected || !topic) return 0;
+  s_mqtt_stats.msgs++;
+  s_mqtt_stats.bytes += len;
+  if (s_pub_cb) s_pub_cb(topic, (const char *) message, len, retain, s_pub_cb_ud);
+  if (++s_packet_id == 0) s_packet_id = 1;
+  (void) qos;
+  return s_packet_id;
+}
+
+uint16_t mgos_mqtt_pubv(const char *topic, int qos, bool retain, const char *json_fmt, va_list ap) {
+  struct mbuf m;
+  struct json_out out = JSON_OUT_MBUF(&m);
+  uint16_t ret;
+
+  mbuf_init(&m, 0);
+  json_vprintf(&out, json_fmt, ap);
+  ret = mgos_mqtt_pub(topic, m.buf, m.len, qos, retain);
+  mbuf_free(&m);
+  return ret;
+}
+
+uint16_t mgos_mqtt_pubf(const char *topic, int qos, bool retain, const char *json_fmt, ...) {
+  va_list ap;
+  uint16_t ret;
+
+  va_start(ap, json_fmt);
+  ret = mgos_mqtt_pubv(topic, qos, retain, json_fmt, ap);
+  va_end(ap);
+  return ret;
+}
+
+bool mgos_mqtt_global_is_connected(void) {
+  return s_connected;
+}
+
+void mgos_mqtt_add_global_handler(mg_event_handler_t handler, void *ud) {
+  struct mgos_host_global_handler *h;
+
+  if (!handler || !(h = calloc(1, sizeof(*h)))) return;
+  h->handler = handler;
+  h->ud = ud;
+  SLIST_INSERT_HEAD(&s_handlers, h, entry);
+}
+
+void mgos_mqtt_set_connect_fn(mgos_mqtt_connect_fn_t cb, void *fn_arg) {
+  s_connect_fn = cb;
+  s_connect_fn_arg = fn_arg;
+}
+
+size_t mgos_mqtt_num_unsent_bytes(void) {
+  return s_unsent;
+}
+
+void mg_send_mqtt_handshake_opt(struct mg_connection *nc, const char *client_id, struct mg_send_mqtt_handshake_opts opts) {
+  (void) nc;
+  (void) client_id;
+  (void) opts;
+}
+
+static void mgos_host_mqtt_event(int ev) {
+  struct mgos_host_global_handler *h;
+
+  SLIST_FOREACH(h, &s_handlers, entry) h->handler(&s_conn, ev, NULL, h->ud);
+}
+
+void mgos_host_mqtt_connect(void) {
+  if (s_connect_fn) {
+    struct mg_send_mqtt_handshake_opts opts;
+
+    memset(&opts, 0, sizeof(opts));
+    s_connect_fn(&s_conn, mgos_sys_config_get_device_id(), &opts, s_connect_fn_arg);
+  }
+  s_connected = true;
+  mgos_host_mqtt_event(MG_EV_MQTT_CONNACK);
+}
+
+void mgos_host_mqtt_disconnect(void) {
+  if (!s_connected) return;
+  s_connected = false;
+  mgos_host_mqtt_event(MG_EV_CLOSE);
+}
+
+// Matches an MQTT topic filter with '+' and '#' wildcards against topic.
+static bool mgos_host_topic_match(const char *filter, const char *topic, int topic_len) {
+  const char *t = topic, *end = topic + topic_len;
+
+  while (*filter) {
+    if (filter[0] == '#') return true;
+    if (filter[0] == '+') {
+      while (t < end && *t != '/') t++;
+      filter++;
+      continue;
+    }
+    if (t == end || *filter != *t) return false;
+    filter++;
+    t++;
+  }
+  return t == end;
+}
+
+int mgos_host_mqtt_deliver(const char *topic, const char *msg, int msg_len) {
+  struct mgos_host_sub *s, *s_tmp;
+  int topic_len = strlen(topic), n = 0;
+
+  // Handlers may subscribe, but not unsubscribe others than themselves.
+  SLIST_FOREACH_SAFE(s, &s_subs, entry, s_tmp) {
+    if (!mgos_host_topic_match(s->topic, topic, topic_len)) continue;
+    s->handler(&s_conn, topic, topic_len, msg, msg_len, s->ud);
+    n++;
+  }
+  return n;
+}
+
+void mgos_host_mqtt_set_unsent(size_t bytes) {
+  s_unsent = bytes;
+}
+
+void mgos_host_mqtt_set_pub_cb(mgos_host_pub_cb cb, void *user_data) {
+  s_pub_cb = cb;
+  s_pub_cb_ud = user_data;
+}
+
+void mgos_host_mqtt_get_stats(struct mgos_host_mqtt_stats *stats) {
+  *stats = s_mqtt_stats;
+}
+
+/* GPIO */
+#define MGOS_HOST_GPIO_PINS 64
+
+static struct {
+  bool level;
+  mgos_gpio_int_handler_f cb;
+  void *arg;
+} s_gpio[MGOS_HOST_GPIO_PINS];
+
+bool mgos_gpio_set_button_handler(int pin, enum mgos_gpio_pull_type pull_type, enum mgos_gpio_int_mode int_mode, int debounce_ms,
+                                  mgos_gpio_int_handler_f cb, void *arg) {
+  if (pin < 0 || pin >= MGOS_HOST_GPIO_PINS) return false;
+  s_gpio[pin].level = pull_type == MGOS_GPIO_PULL_UP;
+  s_gpio[pin].cb = cb;
+  s_gpio[pin].arg = arg;
+  (void) int_mode;
+  (void) debounce_ms;
+  return true;
+}
+
+bool mgos_gpio_setup_output(int pin, bool level) {
+  if (pin < 0 || pin >= MGOS_HOST_GPIO_PINS) return false;
+  s_gpio[pin].level = level;
+  return true;
+}
+
+bool mgos_gpio_read(int pin) {
+  return pin >= 0 && pin < MGOS_HOST_GPIO_PINS && s_gpio[pin].level;
+}
+
+bool mgos_gpio_read_out(int pin) {
+  return mgos_gpio_read(pin);
+}
+
+void mgos_gpio_write(int pin, bool level) {
+  if (pin >= 0 && pin < MGOS_HOST_GPIO_PINS) s_gpio[pin].level = level;
+}
+
+bool mgos_gpio_toggle(int pin) {
+  if (pin < 0 || pin >= MGOS_HOST_GPIO_PINS) return false;
+  s_gpio[pin].level = !s_gpio[pin].level;
+  return s_gpio[pin].level;
+}
+
+void mgos_host_gpio_input(int pin, bool level) {
+  if (pin < 0 || pin >= MGOS_HOST_GPIO_PINS || s_gpio[pin].level == level) return;
+  s_gpio[pin].level = level;
+  if (s_gpio[pin].cb) s_gpio[pin].cb(pin, s_gpio[pin].arg);
+}
+
+void mgos_host_reset(void) {
+  mgos_host_config_reset();
+  while (!SLIST_EMPTY(&s_timers)) {
+    struct mgos_host_timer *t = SLIST_FIRST(&s_timers);
+    SLIST_REMOVE_HEAD(&s_timers, entry);
+    free(t);
+  }
+  while (!SLIST_EMPTY(&s_subs)) {
+    struct mgos_host_sub *s = SLIST_FIRST(&s_subs);
+    SLIST_REMOVE_HEAD(&s_subs, entry);
+    free(s->topic);
+    free(s);
+  }
+  while (!SLIST_EMPTY(&s_handlers)) {
+    struct mgos_host_global_handler *h = SLIST_FIRST(&s_handlers);
+    SLIST_REMOVE_HEAD(&s_handlers, entry);
+    free(h);
+  }
+  s_connect_fn = NULL;
+  s_connect_fn_arg = NULL;
+  s_connected = false;
+  s_unsent = 0;
+  s_pub_cb = NULL;
+  s_pub_cb_ud = NULL;
+  memset(&s_mqtt_stats, 0, sizeof(s_mqtt_stats));
+  memset(s_gpio, 0, sizeof(s_gpio));
+  s_now = 0;
+  s_wall = time(NULL);
+}
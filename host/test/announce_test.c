@@ -0,0 +1,166 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Tests of the announcement after an MQTT (re)connect: configs go first, then
+ * the statuses kept while disconnected, the journal before the offline buffer,
+ * and then the current statuses, newest object first. Both the paced announcement and the burst of
+ * homeassistant.announce.msgs_per_tick=0 are tested.
+ *
+ * Each publish is logged as one letter:
+ *   C  a config
+ *   J  a stamped sensor status, as replayed from the journal
+ *   O  a stamped switch status, as replayed from the offline buffer
+ *   S  a sensor status
+ *   R  a switch status
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "mgos.h"
+#include "mgos_homeassistant.h"
+#include "mgos_host.h"
+
+// Called by mos at boot, and not declared in a header.
+bool mgos_homeassistant_init(void);
+
+#define TEST_CHECK(cond)                                                         \
+  do {                                                                           \
+    if (!(cond)) {                                                               \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      s_failed++;                                                                \
+    }                                                                            \
+  } while (0)
+
+static int s_failed = 0;
+static char s_log[256];
+static int s_log_len = 0;
+static int s_value = 0;
+
+static void test_pub_cb(const char *topic, const char *payload, size_t len, bool retain, void *user_data) {
+  bool stamped = len > 6 && 0 == strncmp(payload, "{\"ts\":", 6);
+  char c;
+
+  if (0 == strncmp(topic, "ha/", 3))
+    c = 'C';
+  else if (0 == strcmp(topic, "host/sensor/temp0"))
+    c = stamped ? 'J' : 'S';
+  else if (0 == strcmp(topic, "host/switch/relay"))
+    c = stamped ? 'O' : 'R';
+  else
+    return;
+  // Configs are logged once per run of them.
+  if (c == 'C' && s_log_len > 0 && s_log[s_log_len - 1] == 'C') return;
+  if (s_log_len < (int) sizeof(s_log) - 1) s_log[s_log_len++] = c;
+  s_log[s_log_len] = '\0';
+  (void) retain;
+  (void) user_data;
+}
+
+static void test_log_check(const char *expected, int line) {
+  if (0 == strcmp(s_log, expected)) return;
+  fprintf(stderr, "%s:%d: publishes '%s', expected '%s'\n", __FILE__, line, s_log, expected);
+  s_failed++;
+}
+
+static void test_log_reset(void) {
+  s_log_len = 0;
+  s_log[0] = '\0';
+}
+
+static void test_status_cb(struct mgos_homeassistant_object *o, struct json_out *json) {
+  json_printf(json, "value:%d", ++s_value);
+  (void) o;
+}
+
+// Keeps two sensor statuses in the journal and a switch status in the
+// offline buffer, and reconnects.
+static void test_reconnect(struct mgos_homeassistant *ha, struct mgos_homeassistant_object *temp0, struct mgos_homeassistant_object *relay) {
+  mgos_host_mqtt_disconnect();
+  mgos_host_advance(1000);
+  TEST_CHECK(mgos_homeassistant_object_send_status(temp0));
+  mgos_host_advance(1000);
+  TEST_CHECK(mgos_homeassistant_object_send_status(relay));
+  TEST_CHECK(mgos_homeassistant_object_send_status(temp0));
+  TEST_CHECK(journal_pending(ha->journal) == 2);
+  TEST_CHECK(ha->offline.records == 1);
+
+  test_log_reset();
+  mgos_host_mqtt_connect();
+  mgos_host_advance(5000);
+  TEST_CHECK(journal_pending(ha->journal) == 0);
+  TEST_CHECK(ha->offline.records == 0);
+}
+
+int main(void) {
+  char dir[] = "/tmp/announce_test.XXXXXX";
+  char file[64];
+  struct mgos_homeassistant *ha;
+  struct mgos_homeassistant_object *temp0, *relay;
+  struct mgos_journal *j;
+
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  snprintf(file, sizeof(file), "%s/ha.journal", dir);
+
+  // A status left in the journal by an earlier boot.
+  j = journal_create(file, 16384, 8);
+  TEST_CHECK(journal_append(j, "temp0", 1000, "{\"value\":0}", 11));
+  journal_destroy(&j);
+
+  mgos_host_reset();
+  mgos_host_mqtt_set_pub_cb(test_pub_cb, NULL);
+  mgos_sys_config_set_homeassistant_journal_file(file);
+  mgos_sys_config_set_homeassistant_offline_bytes(1024);
+  mgos_sys_config_set_homeassistant_offline_samples(2);
+  if (!mgos_homeassistant_init() || !(ha = mgos_homeassistant_get_global())) {
+    fprintf(stderr, "Could not create node\n");
+    return 1;
+  }
+  TEST_CHECK(journal_pending(ha->journal) == 1);
+  temp0 = mgos_homeassistant_object_add(ha, "temp0", COMPONENT_SENSOR, NULL, test_status_cb, NULL);
+  relay = mgos_homeassistant_object_add(ha, "relay", COMPONENT_SWITCH, NULL, test_status_cb, NULL);
+  TEST_CHECK(temp0 && relay);
+
+  // Paced, a few messages per tick.
+  mgos_sys_config_set_homeassistant_announce_msgs_per_tick(5);
+  mgos_host_mqtt_connect();
+  mgos_host_advance(5000);
+  test_log_check("CJRS", __LINE__);
+  TEST_CHECK(access(file, F_OK) != 0);
+  TEST_CHECK(ha->announce.completed == 1);
+
+  test_reconnect(ha, temp0, relay);
+  test_log_check("CJJORS", __LINE__);
+  TEST_CHECK(access(file, F_OK) != 0);
+  TEST_CHECK(ha->announce.completed == 2);
+
+  // In one burst.
+  mgos_sys_config_set_homeassistant_announce_msgs_per_tick(0);
+  test_reconnect(ha, temp0, relay);
+  test_log_check("CJJORS", __LINE__);
+  TEST_CHECK(access(file, F_OK) != 0);
+
+  mgos_homeassistant_clear(ha);
+  mgos_host_advance(0);
+  rmdir(dir);
+  if (s_failed) fprintf(stderr, "%d checks failed\n", s_failed);
+  return s_failed ? 1 : 0;
+}
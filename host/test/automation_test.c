@@ -0,0 +1,95 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Tests of automations whose actions add actions to the automation, and run
+ * it again on the same stack: the program being run is kept until they are
+ * done, and the added action runs from the next run on.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mgos.h"
+#include "mgos_homeassistant.h"
+#include "mgos_homeassistant_automation.h"
+#include "mgos_host.h"
+
+// Called by mos at boot, and not declared in a header.
+bool mgos_homeassistant_init(void);
+
+#define TEST_CHECK(cond)                                                         \
+  do {                                                                           \
+    if (!(cond)) {                                                               \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      s_failed++;                                                                \
+    }                                                                            \
+  } while (0)
+
+#define TEST_STATUS "{\"state\":\"ON\"}"
+
+static int s_failed = 0;
+static int s_first = 0, s_added = 0;
+
+// Upon the first command, adds an action to the automation, and triggers it
+// again while its actions run.
+static void test_cmd_cb(struct mgos_homeassistant_object *o, const char *payload, const int payload_len) {
+  struct mgos_homeassistant *ha = o->ha;
+  struct mgos_homeassistant_automation_data_action_command *dd;
+  struct mgos_homeassistant_object *sensor = mgos_homeassistant_object_get(ha, "sensor");
+
+  if (payload_len == 5 && 0 == strncmp(payload, "added", 5)) {
+    s_added++;
+    return;
+  }
+  if (++s_first > 1) return;
+  if (!(dd = calloc(1, sizeof(*dd)))) return;
+  dd->object = strdup("switch");
+  dd->payload = strdup("added");
+  TEST_CHECK(mgos_homeassistant_automation_add_action(SLIST_FIRST(&ha->automations), ACTION_COMMAND, dd));
+  mgos_homeassistant_call_handlers(ha, MGOS_HOMEASSISTANT_EV_OBJECT_STATUS, sensor);
+}
+
+int main(void) {
+  static const char json[] =
+      "{\"automation\":[{\"trigger\":[{\"type\":\"status\",\"object\":\"sensor\",\"status\":\"ON\"}],"
+      "\"action\":[{\"type\":\"command\",\"object\":\"switch\",\"payload\":\"first\"}]}]}";
+  struct mgos_homeassistant *ha;
+  struct mgos_homeassistant_object *sensor, *sw;
+
+  mgos_host_reset();
+  if (!mgos_homeassistant_init() || !(ha = mgos_homeassistant_get_global())) {
+    fprintf(stderr, "Could not create node\n");
+    return 1;
+  }
+  sensor = mgos_homeassistant_object_add(ha, "sensor", COMPONENT_SENSOR, NULL, NULL, NULL);
+  sw = mgos_homeassistant_object_add(ha, "switch", COMPONENT_SWITCH, NULL, NULL, NULL);
+  TEST_CHECK(sensor && sw);
+  TEST_CHECK(mgos_homeassistant_object_add_cmd_cb(sw, NULL, test_cmd_cb));
+  TEST_CHECK(mgos_homeassistant_fromjson(ha, json));
+  mbuf_append(&sensor->status, TEST_STATUS, strlen(TEST_STATUS));
+
+  // The run nested in the first command runs the program as it was.
+  mgos_homeassistant_call_handlers(ha, MGOS_HOMEASSISTANT_EV_OBJECT_STATUS, sensor);
+  TEST_CHECK(s_first == 2 && s_added == 0);
+
+  // Once they are done, the added action is compiled and runs.
+  mgos_homeassistant_call_handlers(ha, MGOS_HOMEASSISTANT_EV_OBJECT_STATUS, sensor);
+  TEST_CHECK(s_first == 3 && s_added == 1);
+
+  mgos_homeassistant_clear(ha);
+  if (s_failed) fprintf(stderr, "%d checks failed\n", s_failed);
+  return s_failed ? 1 : 0;
+}
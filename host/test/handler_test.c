@@ -0,0 +1,108 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Tests of event handlers that remove objects, and with them handlers, or add
+ * handlers while an event is being dispatched: every other handler is called
+ * exactly once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mgos.h"
+#include "mgos_homeassistant.h"
+#include "mgos_host.h"
+
+// Called by mos at boot, and not declared in a header.
+bool mgos_homeassistant_init(void);
+
+#define TEST_CHECK(cond)                                                         \
+  do {                                                                           \
+    if (!(cond)) {                                                               \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      s_failed++;                                                                \
+    }                                                                            \
+  } while (0)
+
+static int s_failed = 0;
+
+static void test_count_cb(struct mgos_homeassistant *ha, const int ev, const void *ev_data, void *user_data) {
+  (*(int *) user_data)++;
+  (void) ha;
+  (void) ev;
+  (void) ev_data;
+}
+
+// Removes object c, and with it the handler filtered on c.
+static void test_remove_cb(struct mgos_homeassistant *ha, const int ev, const void *ev_data, void *user_data) {
+  struct mgos_homeassistant_object *o = mgos_homeassistant_object_get(ha, "c");
+
+  (*(int *) user_data)++;
+  mgos_homeassistant_object_remove(&o);
+  (void) ev;
+  (void) ev_data;
+}
+
+static void test_add_cb(struct mgos_homeassistant *ha, const int ev, const void *ev_data, void *user_data) {
+  static int added = 0;
+
+  (*(int *) user_data)++;
+  mgos_homeassistant_add_handler_mask(ha, test_count_cb, MGOS_HOMEASSISTANT_EVM_OBJECT_STATUS, NULL, &added);
+  (void) ev;
+  (void) ev_data;
+}
+
+int main(void) {
+  struct mgos_homeassistant *ha;
+  struct mgos_homeassistant_object *a, *b, *c;
+  int before = 0, on_c = 0, removing = 0, after = 0, adding = 0;
+
+  mgos_host_reset();
+  if (!mgos_homeassistant_init() || !(ha = mgos_homeassistant_get_global())) {
+    fprintf(stderr, "Could not create node\n");
+    return 1;
+  }
+  a = mgos_homeassistant_object_add(ha, "a", COMPONENT_SENSOR, NULL, NULL, NULL);
+  b = mgos_homeassistant_object_add(ha, "b", COMPONENT_SENSOR, NULL, NULL, NULL);
+  c = mgos_homeassistant_object_add(ha, "c", COMPONENT_SENSOR, NULL, NULL, NULL);
+  TEST_CHECK(a && b && c);
+
+  // Newest first: before, the handler on c, the handler on b that removes c,
+  // and after.
+  TEST_CHECK(mgos_homeassistant_add_handler_mask(ha, test_count_cb, MGOS_HOMEASSISTANT_EVM_OBJECT_STATUS, NULL, &after));
+  TEST_CHECK(mgos_homeassistant_add_handler_mask(ha, test_remove_cb, MGOS_HOMEASSISTANT_EVM_OBJECT_STATUS, b, &removing));
+  TEST_CHECK(mgos_homeassistant_add_handler_mask(ha, test_count_cb, MGOS_HOMEASSISTANT_EVM_OBJECT_STATUS, c, &on_c));
+  TEST_CHECK(mgos_homeassistant_add_handler_mask(ha, test_count_cb, MGOS_HOMEASSISTANT_EVM_OBJECT_STATUS, NULL, &before));
+
+  mgos_homeassistant_call_handlers(ha, MGOS_HOMEASSISTANT_EV_OBJECT_STATUS, b);
+  TEST_CHECK(before == 1 && on_c == 0 && removing == 1 && after == 1);
+  TEST_CHECK(mgos_homeassistant_object_get(ha, "c") == NULL);
+
+  // The removed handler is gone, and the others are called once.
+  mgos_homeassistant_call_handlers(ha, MGOS_HOMEASSISTANT_EV_OBJECT_STATUS, b);
+  TEST_CHECK(before == 2 && on_c == 0 && removing == 2 && after == 2);
+
+  // A handler added while dispatching is called from the next event on.
+  TEST_CHECK(mgos_homeassistant_add_handler_mask(ha, test_add_cb, MGOS_HOMEASSISTANT_EVM_OBJECT_STATUS, a, &adding));
+  mgos_homeassistant_call_handlers(ha, MGOS_HOMEASSISTANT_EV_OBJECT_STATUS, a);
+  TEST_CHECK(before == 3 && adding == 1 && after == 3);
+  mgos_homeassistant_call_handlers(ha, MGOS_HOMEASSISTANT_EV_OBJECT_STATUS, a);
+  TEST_CHECK(before == 4 && adding == 2 && after == 4);
+
+  mgos_homeassistant_clear(ha);
+  if (s_failed) fprintf(stderr, "%d checks failed\n", s_failed);
+  return s_failed ? 1 : 0;
+}
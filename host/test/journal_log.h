@@ -0,0 +1,25 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/* Included ahead of journal.c by journal_test, which builds the journal
+ * without mgos, so that its errors go to stderr.
+ */
+
+#include <stdio.h>
+
+#define JOURNAL_LOG(fmt, ...) fprintf(stderr, "journal: " fmt "\n", __VA_ARGS__)
@@ -0,0 +1,227 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Tests of the journal against a temporary directory. It is built from
+ * journal.c alone, without the mgos stand-ins, and journal_log.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+#define TEST_CHECK(cond)                                                         \
+  do {                                                                           \
+    if (!(cond)) {                                                               \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      s_failed++;                                                                \
+    }                                                                            \
+  } while (0)
+
+static int s_failed = 0;
+static char s_file[64];
+
+struct replayed {
+  int n;
+  char names[16][JOURNAL_NAME_MAX];
+  uint32_t ts[16];
+};
+
+static void test_replay_cb(const char *name, uint32_t ts, const char *payload, size_t len, void *user_data) {
+  struct replayed *r = (struct replayed *) user_data;
+
+  if (r->n >= 16) return;
+  snprintf(r->names[r->n], sizeof(r->names[r->n]), "%s", name);
+  r->ts[r->n] = ts;
+  r->n++;
+  TEST_CHECK(len == 4 && 0 == memcmp(payload, "{\"v\"", 4));
+}
+
+static long test_file_size(void) {
+  struct stat st;
+
+  if (0 != stat(s_file, &st)) return -1;
+  return (long) st.st_size;
+}
+
+static bool test_append(struct mgos_journal *j, const char *name, double ts) {
+  return journal_append(j, name, ts, "{\"v\"", 4);
+}
+
+// Appends in RAM until the batch is full, then writes the batch at once.
+static void test_batch(void) {
+  struct mgos_journal *j = journal_create(s_file, 16 * JOURNAL_RECORD_SIZE, 4);
+  struct mgos_journal_stats st;
+
+  TEST_CHECK(j != NULL);
+  for (int i = 0; i < 3; i++) TEST_CHECK(test_append(j, "temp0", 1000 + i));
+  TEST_CHECK(journal_pending(j) == 3);
+  TEST_CHECK(test_file_size() == -1);
+  TEST_CHECK(test_append(j, "temp0", 1003));
+  TEST_CHECK(test_file_size() == 4 * JOURNAL_RECORD_SIZE);
+  TEST_CHECK(test_append(j, "temp0", 1004));
+  TEST_CHECK(journal_flush(j));
+  TEST_CHECK(test_file_size() == 5 * JOURNAL_RECORD_SIZE);
+  TEST_CHECK(journal_get_stats(j, &st));
+  TEST_CHECK(st.appended == 5 && st.written == 5 && st.dropped == 0);
+
+  // Names and payloads that do not fit a record are dropped.
+  TEST_CHECK(!test_append(j, "a_name_of_21_letters_", 1005));
+  TEST_CHECK(!journal_append(j, "temp0", 1005, "{}", JOURNAL_PAYLOAD_MAX + 1));
+  TEST_CHECK(journal_get_stats(j, &st) && st.dropped == 2);
+  TEST_CHECK(journal_pending(j) == 5);
+  TEST_CHECK(journal_destroy(&j) && j == NULL);
+  remove(s_file);
+}
+
+// Appends beyond max_bytes are dropped, including those still in the batch.
+static void test_size_cap(void) {
+  struct mgos_journal *j = journal_create(s_file, 4 * JOURNAL_RECORD_SIZE + 10, 3);
+  struct mgos_journal_stats st;
+
+  for (int i = 0; i < 4; i++) TEST_CHECK(test_append(j, "temp0", 1000 + i));
+  TEST_CHECK(!test_append(j, "temp0", 1004));
+  TEST_CHECK(journal_flush(j));
+  TEST_CHECK(!test_append(j, "temp0", 1005));
+  TEST_CHECK(test_file_size() == 4 * JOURNAL_RECORD_SIZE);
+  TEST_CHECK(journal_get_stats(j, &st) && st.appended == 4 && st.dropped == 2);
+  journal_destroy(&j);
+  remove(s_file);
+}
+
+// Replays in order, a few at a time, and removes the file after the last
+// record, after which appends start over.
+static void test_replay(void) {
+  struct mgos_journal *j = journal_create(s_file, 16 * JOURNAL_RECORD_SIZE, 2);
+  struct replayed r = {0};
+
+  TEST_CHECK(test_append(j, "temp0", 1000));
+  TEST_CHECK(test_append(j, "temp1", 1001));
+  TEST_CHECK(test_append(j, "temp2", 1002));
+  TEST_CHECK(journal_replay(j, 2, test_replay_cb, &r) == 2);
+  TEST_CHECK(r.n == 2 && 0 == strcmp(r.names[0], "temp0") && 0 == strcmp(r.names[1], "temp1"));
+  TEST_CHECK(r.ts[0] == 1000 && r.ts[1] == 1001);
+  TEST_CHECK(journal_pending(j) == 1);
+  TEST_CHECK(test_file_size() == 3 * JOURNAL_RECORD_SIZE);
+
+  TEST_CHECK(journal_replay(j, 2, test_replay_cb, &r) == 1);
+  TEST_CHECK(r.n == 3 && 0 == strcmp(r.names[2], "temp2"));
+  TEST_CHECK(journal_pending(j) == 0);
+  TEST_CHECK(test_file_size() == -1);
+  TEST_CHECK(journal_replay(j, 2, test_replay_cb, &r) == 0);
+
+  TEST_CHECK(test_append(j, "temp3", 1003));
+  TEST_CHECK(journal_flush(j));
+  TEST_CHECK(test_file_size() == JOURNAL_RECORD_SIZE);
+  TEST_CHECK(journal_replay(j, 2, test_replay_cb, &r) == 1);
+  TEST_CHECK(r.n == 4 && 0 == strcmp(r.names[3], "temp3"));
+  TEST_CHECK(test_file_size() == -1);
+  journal_destroy(&j);
+}
+
+// A journal created over the file of an earlier boot picks up its records. A
+// record torn by the reboot fails its CRC and is skipped, and a partial
+// record at the end is not counted.
+static void test_reboot(void) {
+  struct mgos_journal *j = journal_create(s_file, 16 * JOURNAL_RECORD_SIZE, 8);
+  struct mgos_journal_stats st;
+  struct replayed r = {0};
+  FILE *fp;
+
+  for (int i = 0; i < 3; i++) TEST_CHECK(test_append(j, "temp0", 1000 + i));
+  // Destroying flushes the batch.
+  journal_destroy(&j);
+  TEST_CHECK(test_file_size() == 3 * JOURNAL_RECORD_SIZE);
+
+  TEST_CHECK((fp = fopen(s_file, "r+b")) != NULL);
+  fseek(fp, JOURNAL_RECORD_SIZE + 20, SEEK_SET);
+  fputc('X', fp);
+  fseek(fp, 0, SEEK_END);
+  fwrite("partial", 1, 7, fp);
+  fclose(fp);
+
+  j = journal_create(s_file, 16 * JOURNAL_RECORD_SIZE, 8);
+  TEST_CHECK(journal_pending(j) == 3);
+  TEST_CHECK(journal_replay(j, 10, test_replay_cb, &r) == 3);
+  TEST_CHECK(r.n == 2 && r.ts[0] == 1000 && r.ts[1] == 1002);
+  TEST_CHECK(journal_get_stats(j, &st) && st.corrupt == 1 && st.replayed == 2);
+  TEST_CHECK(journal_pending(j) == 0);
+  TEST_CHECK(test_file_size() == -1);
+  journal_destroy(&j);
+}
+
+// A reboot during replay resumes after the records replayed before it.
+static void test_resume(void) {
+  struct mgos_journal *j = journal_create(s_file, 16 * JOURNAL_RECORD_SIZE, 1);
+  struct replayed r = {0};
+  char pos[sizeof(s_file) + 4];
+
+  snprintf(pos, sizeof(pos), "%s.pos", s_file);
+  for (int i = 0; i < 5; i++) TEST_CHECK(test_append(j, "temp0", 1000 + i));
+  TEST_CHECK(journal_replay(j, 2, test_replay_cb, &r) == 2);
+  TEST_CHECK(access(pos, F_OK) == 0);
+  journal_destroy(&j);
+
+  j = journal_create(s_file, 16 * JOURNAL_RECORD_SIZE, 1);
+  TEST_CHECK(journal_pending(j) == 3);
+  TEST_CHECK(journal_replay(j, 10, test_replay_cb, &r) == 3);
+  TEST_CHECK(r.n == 5 && r.ts[2] == 1002 && r.ts[4] == 1004);
+  TEST_CHECK(test_file_size() == -1);
+  TEST_CHECK(access(pos, F_OK) != 0);
+  journal_destroy(&j);
+}
+
+// A file cut short after it was counted ends the replay at the last whole
+// record.
+static void test_partial_tail(void) {
+  struct mgos_journal *j = journal_create(s_file, 16 * JOURNAL_RECORD_SIZE, 1);
+  struct replayed r = {0};
+
+  for (int i = 0; i < 3; i++) TEST_CHECK(test_append(j, "temp0", 1000 + i));
+  TEST_CHECK(0 == truncate(s_file, 2 * JOURNAL_RECORD_SIZE + 50));
+  TEST_CHECK(journal_pending(j) == 3);
+  TEST_CHECK(journal_replay(j, 10, test_replay_cb, &r) == 2);
+  TEST_CHECK(r.n == 2 && r.ts[1] == 1001);
+  TEST_CHECK(journal_pending(j) == 0);
+  TEST_CHECK(test_file_size() == -1);
+  journal_destroy(&j);
+}
+
+int main(void) {
+  char dir[] = "/tmp/journal_test.XXXXXX";
+
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  snprintf(s_file, sizeof(s_file), "%s/ha.journal", dir);
+
+  TEST_CHECK(journal_create(s_file, JOURNAL_RECORD_SIZE - 1, 8) == NULL);
+  test_batch();
+  test_size_cap();
+  test_replay();
+  test_reboot();
+  test_resume();
+  test_partial_tail();
+
+  remove(s_file);
+  rmdir(dir);
+  if (s_failed) fprintf(stderr, "%d checks failed\n", s_failed);
+  return s_failed ? 1 : 0;
+}
@@ -17,10 +17,13 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "common/mbuf.h"
 #include "common/queue.h"
 #include "frozen/frozen.h"
+#include "mgos_timers.h"
 
 struct mgos_homeassistant;
 struct mgos_homeassistant_handler;
@@ -55,22 +58,146 @@ enum mgos_homeassistant_component {
 #define MGOS_HOMEASSISTANT_EV_CLASS_REMOVE 31    // ev_data: struct mgos_homeassistant_object_class *
 #define MGOS_HOMEASSISTANT_EV_AUTOMATION_RUN 40  // ev_data: struct mgos_homeassistant_automation *
 
+// Event masks for mgos_homeassistant_add_handler_mask()
+#define MGOS_HOMEASSISTANT_EVM_ADD_HANDLER (1 << 0)
+#define MGOS_HOMEASSISTANT_EVM_CLEAR (1 << 1)
+#define MGOS_HOMEASSISTANT_EVM_OBJECT_ADD (1 << 2)
+#define MGOS_HOMEASSISTANT_EVM_OBJECT_STATUS (1 << 3)
+#define MGOS_HOMEASSISTANT_EVM_OBJECT_CMD (1 << 4)
+#define MGOS_HOMEASSISTANT_EVM_OBJECT_ATTR (1 << 5)
+#define MGOS_HOMEASSISTANT_EVM_OBJECT_REMOVE (1 << 6)
+#define MGOS_HOMEASSISTANT_EVM_CLASS_ADD (1 << 7)
+#define MGOS_HOMEASSISTANT_EVM_CLASS_REMOVE (1 << 8)
+#define MGOS_HOMEASSISTANT_EVM_AUTOMATION_RUN (1 << 9)
+#define MGOS_HOMEASSISTANT_EV_COUNT 10
+#define MGOS_HOMEASSISTANT_EVM_ALL ((1 << MGOS_HOMEASSISTANT_EV_COUNT) - 1)
+
 typedef void (*ha_object_cb)(struct mgos_homeassistant_object *o);
 typedef void (*ha_status_cb)(struct mgos_homeassistant_object *o, struct json_out *json);
 typedef void (*ha_cmd_cb)(struct mgos_homeassistant_object *o, const char *payload, const int payload_len);
 typedef void (*ha_attr_cb)(struct mgos_homeassistant_object *o, const char *payload, const int payload_len);
 typedef void (*ha_ev_handler)(struct mgos_homeassistant *ha, const int ev, const void *ev_data, void *user_data);
 
+// Number of buckets in the object name and suffix indexes of a node.
+#define MGOS_HOMEASSISTANT_INDEX_SIZE 32
+// Object names are indexed by their last few characters, so that suffix
+// lookups of at least this length are served from the suffix index.
+#define MGOS_HOMEASSISTANT_SUFFIX_LEN 3
+
+// Progress of the paced announcement of configs and statuses, which is
+// started by mgos_homeassistant_announce() and drained by a timer.
+struct mgos_homeassistant_announce {
+  mgos_timer_id timer;
+  struct mgos_homeassistant_object *next;  // next object to announce, NULL when done
+  bool status_phase;                       // all configs are announced first, then all statuses
+  double started;                          // uptime when the current or last announcement started
+  double duration;                         // seconds taken by the last completed announcement
+  uint32_t ticks;                          // timer ticks used by the current or last announcement
+  uint32_t stalls;                         // ticks cut short because the MQTT send buffer was full
+  uint32_t msgs;                           // messages published by the current or last announcement
+  uint32_t bytes;                          // payload bytes published by the current or last announcement
+  uint32_t completed;                      // number of completed announcements
+};
+
+// Status of all aggregated objects of a node, published as one JSON document,
+// keyed by object name, if homeassistant.aggregate.enable is set.
+struct mgos_homeassistant_aggregate {
+  char *topic;          // '<node>/status'
+  struct mbuf payload;  // last rendered aggregated status
+  bool pending;         // an aggregated object's status changed since the last publish
+  bool force;           // publish even if the aggregated status is unchanged
+  uint32_t hash;        // content hash of the last published aggregated status
+  double sent_at;       // uptime at which it was published
+};
+
+// Usage of the node's arena, see mgos_homeassistant_arena_stats().
+struct mgos_homeassistant_arena_stats {
+  size_t reserved;        // bytes held in arena chunks
+  size_t used;            // bytes in live arena allocations
+  size_t peak;            // highest value of used since boot
+  size_t freed;           // bytes freed inside the chunks, reclaimed when the arena is reset
+  uint32_t chunks;        // number of arena chunks
+  uint32_t allocs;        // number of live arena allocations
+  uint32_t resets;        // number of times the arena was reset
+  uint8_t fragmentation;  // percentage of reserved bytes not in use
+};
+
+// Objects, classes, commands and attributes, and their names and payloads,
+// are allocated from chunks of chunk_size bytes. A chunk_size of 0 uses the
+// heap. Memory freed inside a chunk is only reclaimed once all allocations
+// are freed, which is the case after mgos_homeassistant_clear().
+struct mgos_homeassistant_arena {
+  size_t chunk_size;
+  SLIST_HEAD(arena_chunks, mgos_homeassistant_arena_chunk) chunks;  // current chunk first
+  struct mgos_homeassistant_arena_stats stats;
+};
+
+// Statuses rendered while MQTT is disconnected, kept in a ring buffer of
+// homeassistant.offline.bytes and replayed by the next announcement.
+struct mgos_homeassistant_offline {
+  char *buf;
+  size_t size;
+  size_t head;           // offset at which the next record is written
+  size_t tail;           // offset of the oldest record
+  uint32_t records;      // records in the buffer, including overwritten ones
+  uint32_t queued;       // statuses waiting to be replayed
+  uint32_t dropped;      // statuses dropped to make room, or too large to keep
+  uint32_t overwritten;  // statuses replaced by a newer one of the same object
+  uint32_t replayed;     // statuses published after reconnecting
+};
+
+// Object and class names are interned per node: each distinct name is held
+// once, and shared by all objects and classes that carry it.
+struct mgos_homeassistant_name {
+  uint32_t hash;
+  uint16_t refs;
+  SLIST_ENTRY(mgos_homeassistant_name) entry;
+  char str[];
+};
+
+struct mgos_journal;
+struct mgos_homeassistant_scheduler;
+struct mgos_homeassistant_automation_queue;
+
 struct mgos_homeassistant {
   char *node_name;
+  char *node_topic;        // '<node>/#' subscription, if homeassistant.node_subscription is set
+  char *discovery_prefix;  // homeassistant.discovery_prefix as used in the cached config topics
+  char *device_config;     // rendered 'dev' block of the discovery config, shared by all objects
+
+  STAILQ_HEAD(dirty, mgos_homeassistant_object) dirty;  // objects with a deferred status
+  mgos_timer_id dirty_timer;
+
+  struct mgos_homeassistant_aggregate aggregate;
+
+  uint32_t pub_msgs;   // config and status messages published by the node
+  uint32_t pub_bytes;  // payload bytes of those messages
+  struct mgos_homeassistant_announce announce;
+  struct mgos_homeassistant_offline offline;
+  struct mgos_journal *journal;  // sensor statuses kept in a file while disconnected, if homeassistant.journal.file is set
+  struct mgos_homeassistant_scheduler *scheduler;  // deadlines of time based automations, on a single timer
+  struct mgos_homeassistant_automation_queue *automation_queue;  // automation runs, if homeassistant.automation.queue_size is set
+  struct mgos_homeassistant_arena arena;
+  SLIST_HEAD(names, mgos_homeassistant_name) names[MGOS_HOMEASSISTANT_INDEX_SIZE];
 
   SLIST_HEAD(objects, mgos_homeassistant_object) objects;
+  SLIST_HEAD(object_index, mgos_homeassistant_object) name_index[MGOS_HOMEASSISTANT_INDEX_SIZE];
+  struct object_index suffix_index[MGOS_HOMEASSISTANT_INDEX_SIZE];
   SLIST_HEAD(automations, mgos_homeassistant_automation) automations;
+  // Status triggers of the automations, by the name hash of their object
+  SLIST_HEAD(trigger_index, mgos_homeassistant_automation_data) trigger_index[MGOS_HOMEASSISTANT_INDEX_SIZE];
   SLIST_HEAD(handlers, mgos_homeassistant_handler) handlers;
+  // Handlers in call order, per event, indexed by the event's bit in MGOS_HOMEASSISTANT_EVM_*
+  struct mgos_homeassistant_handler **ev_handlers[MGOS_HOMEASSISTANT_EV_COUNT];
+  uint8_t ev_handlers_len[MGOS_HOMEASSISTANT_EV_COUNT];
+  int dispatching;        // nesting depth of mgos_homeassistant_call_handlers()
+  bool handlers_removed;  // handlers were removed while dispatching, and are freed once it is done
 };
 
 struct mgos_homeassistant_object_cmd {
-  char *cmd_name;
+  char *cmd_name;     // NULL for the default command, otherwise stored after the struct
+  uint32_t cmd_hash;  // case-insensitive hash of cmd_name
+  size_t cmd_len;
   ha_cmd_cb cmd_cb;
   struct mgos_homeassistant_object *object;
 
@@ -78,20 +205,62 @@ struct mgos_homeassistant_object_cmd {
 };
 
 struct mgos_homeassistant_object_attr {
-  char *attr_name;
+  char *attr_name;     // NULL for the default attribute, otherwise stored after the struct
+  uint32_t attr_hash;  // case-insensitive hash of attr_name
+  size_t attr_len;
   ha_attr_cb attr_cb;
   struct mgos_homeassistant_object *object;
 
   SLIST_ENTRY(mgos_homeassistant_object_attr) entry;
 };
 
+// Topics of an object, NULL terminated and held in a single allocation (buf).
+struct mgos_homeassistant_object_topics {
+  char *buf;
+  const char *prefix;  // '<node>/<component>/<object>', also the status topic
+  const char *cmd;     // '<prefix>/cmd'
+  const char *attr;    // '<prefix>/attr'
+  const char *log;     // '<prefix>/log'
+  const char *sub;     // '<prefix>/#'
+  const char *config;  // '<discovery_prefix>/<component>/<node>/<object>/config'
+  size_t prefix_len;
+};
+
+// Status callback durations are counted in buckets of below 100us, 1ms, 10ms,
+// 100ms, 1s and the rest.
+#define MGOS_HOMEASSISTANT_CB_HIST_BUCKETS 6
+
+// Runtime counters of an object or class. Classes only count their renders,
+// status callback timings, configs and config bytes.
+struct mgos_homeassistant_stats {
+  uint32_t renders;     // statuses rendered
+  uint32_t publishes;   // statuses published
+  uint32_t suppressed;  // statuses not published because they were unchanged
+  uint32_t configs;     // configs published
+  uint32_t bytes;       // status and config payload bytes published
+  uint32_t cmds;        // commands and attributes called
+  uint32_t cb_us_max;   // longest status callback
+  uint64_t cb_us_total;
+  uint32_t cb_hist[MGOS_HOMEASSISTANT_CB_HIST_BUCKETS];
+};
+
+// Rendered discovery config of an object or class, kept until invalidated.
+struct mgos_homeassistant_config_cache {
+  struct mbuf payload;  // empty if not rendered since the last invalidation
+  uint32_t hash;        // content hash of the last rendered payload
+  uint32_t sent_hash;   // content hash of the last published payload
+  bool sent;
+};
+
 struct mgos_homeassistant_object {
   struct mgos_homeassistant *ha;
   enum mgos_homeassistant_component component;
-  char *object_name;
+  char *object_name;  // interned in the node's name table
 
   bool config_sent;
   char *json_config_additional_payload;
+  bool payload_static;  // json_config_additional_payload is borrowed from the caller, not copied
+  struct mgos_homeassistant_config_cache config;
 
   ha_status_cb status_cb;
   ha_object_cb pre_remove_cb;
@@ -100,16 +269,30 @@ struct mgos_homeassistant_object {
   void *user_data;
 
   struct mbuf status;
+  uint32_t status_hash;     // content hash of the last published status
+  double status_sent_at;    // uptime at which it was published
+  bool status_dirty;        // status is deferred, see mgos_homeassistant_object_mark_dirty()
+  bool aggregated;          // status is published as part of the node's aggregated status
+  uint16_t offline_queued;  // statuses of this object in the node's offline buffer
+  struct mgos_homeassistant_object_topics topics;
+  struct mgos_homeassistant_stats stats;
 
   SLIST_HEAD(classes, mgos_homeassistant_object_class) classes;
   SLIST_ENTRY(mgos_homeassistant_object) entry;
+  SLIST_ENTRY(mgos_homeassistant_object) name_entry;
+  SLIST_ENTRY(mgos_homeassistant_object) suffix_entry;
+  STAILQ_ENTRY(mgos_homeassistant_object) dirty_entry;
 };
 
 struct mgos_homeassistant_object_class {
   struct mgos_homeassistant_object *object;
   enum mgos_homeassistant_component component;
-  char *class_name;
+  char *class_name;  // interned in the node's name table
   char *json_config_additional_payload;
+  bool payload_static;  // json_config_additional_payload is borrowed from the caller, not copied
+  char *config_topic;  // '<discovery_prefix>/<component>/<node>/<object>_<class>/config'
+  struct mgos_homeassistant_config_cache config;
+  struct mgos_homeassistant_stats stats;
 
   ha_status_cb status_cb;
 
@@ -119,6 +302,9 @@ struct mgos_homeassistant_object_class {
 struct mgos_homeassistant_handler {
   ha_ev_handler ev_handler;
   void *user_data;
+  uint32_t ev_mask;                          // MGOS_HOMEASSISTANT_EVM_* the handler is called for
+  struct mgos_homeassistant_object *object;  // if set, only object, cmd, attr and class events of this object
+  bool removed;                              // removed while dispatching, no longer called
 
   SLIST_ENTRY(mgos_homeassistant_handler) entry;
 };
@@ -128,14 +314,39 @@ extern "C" {
 #endif
 
 bool mgos_homeassistant_send_config(struct mgos_homeassistant *ha, bool force);
+// Returns a content hash over the discovery configs of all objects and
+// classes of the node, which changes only when any of them changes.
+uint32_t mgos_homeassistant_config_hash(struct mgos_homeassistant *ha);
 bool mgos_homeassistant_send_status(struct mgos_homeassistant *ha);
+// Resends all configs and then all statuses, paced over several event loop
+// iterations according to homeassistant.announce.*
+bool mgos_homeassistant_announce(struct mgos_homeassistant *ha);
+// Sends the statuses of all objects that were marked dirty.
+bool mgos_homeassistant_flush_status(struct mgos_homeassistant *ha);
+// Rebuilds the cached topics of all objects and classes, and moves their
+// subscriptions along. Call after changing ha->node_name.
+bool mgos_homeassistant_update_topics(struct mgos_homeassistant *ha);
+// Fills stats with the usage of the node's arena. All counters are 0 if
+// homeassistant.arena_chunk_size is not set.
+bool mgos_homeassistant_arena_stats(struct mgos_homeassistant *ha, struct mgos_homeassistant_arena_stats *stats);
 bool mgos_homeassistant_add_handler(struct mgos_homeassistant *ha, ha_ev_handler ev_handler, void *user_data);
+bool mgos_homeassistant_add_handler_mask(struct mgos_homeassistant *ha, ha_ev_handler ev_handler, uint32_t ev_mask,
+                                         struct mgos_homeassistant_object *object, void *user_data);
 bool mgos_homeassistant_call_handlers(struct mgos_homeassistant *ha, int ev, void *ev_data);
+// Case-insensitive hash of a name, as used by the node's indexes.
+uint32_t mgos_homeassistant_name_hash(const char *s, size_t len);
 
 struct mgos_homeassistant_object *mgos_homeassistant_object_add(struct mgos_homeassistant *ha, const char *object_name,
                                                                 enum mgos_homeassistant_component ha_component,
                                                                 const char *json_config_additional_payload, ha_status_cb status, void *user_data);
+// As mgos_homeassistant_object_add(), but json_config_additional_payload is
+// not copied: it must outlive the object, like a string literal does.
+struct mgos_homeassistant_object *mgos_homeassistant_object_add_static(struct mgos_homeassistant *ha, const char *object_name,
+                                                                       enum mgos_homeassistant_component ha_component,
+                                                                       const char *json_config_additional_payload, ha_status_cb status,
+                                                                       void *user_data);
 struct mgos_homeassistant_object *mgos_homeassistant_object_get(struct mgos_homeassistant *ha, const char *suffix);
+struct mgos_homeassistant_object *mgos_homeassistant_object_get_exact(struct mgos_homeassistant *ha, const char *name);
 bool mgos_homeassistant_object_generate_name(struct mgos_homeassistant *ha, const char *prefix, char *name, int namelen);
 bool mgos_homeassistant_object_cmd(struct mgos_homeassistant_object *o, const char *name, const char *payload, const int payload_len);
 bool mgos_homeassistant_object_attr(struct mgos_homeassistant_object *o, const char *name, const char *payload, const int payload_len);
@@ -144,15 +355,29 @@ bool mgos_homeassistant_object_add_cmd_cb(struct mgos_homeassistant_object *o, c
 bool mgos_homeassistant_object_add_attr_cb(struct mgos_homeassistant_object *o, const char *name, ha_attr_cb attr);
 bool mgos_homeassistant_object_get_status(struct mgos_homeassistant_object *o);
 bool mgos_homeassistant_object_send_status(struct mgos_homeassistant_object *o);
+bool mgos_homeassistant_object_refresh_status(struct mgos_homeassistant_object *o);
+// Defers sending the status of the object until the end of the current event
+// loop iteration, or homeassistant.status_coalesce_ms later. Marking an object
+// dirty several times in that window results in one status being sent.
+bool mgos_homeassistant_object_mark_dirty(struct mgos_homeassistant_object *o);
+// Sends the deferred status of the object now, if it is marked dirty.
+bool mgos_homeassistant_object_flush_status(struct mgos_homeassistant_object *o);
 bool mgos_homeassistant_object_send_config(struct mgos_homeassistant_object *o);
 bool mgos_homeassistant_object_remove(struct mgos_homeassistant_object **o);
+// Fills stats with the runtime counters of the object.
+bool mgos_homeassistant_object_get_stats(struct mgos_homeassistant_object *o, struct mgos_homeassistant_stats *stats);
 
 struct mgos_homeassistant_object_class *mgos_homeassistant_object_class_add(struct mgos_homeassistant_object *o, const char *class_name,
                                                                             const char *json_config_additional_payload, ha_status_cb cb);
+// As mgos_homeassistant_object_class_add(), but json_config_additional_payload
+// is not copied: it must outlive the class, like a string literal does.
+struct mgos_homeassistant_object_class *mgos_homeassistant_object_class_add_static(struct mgos_homeassistant_object *o, const char *class_name,
+                                                                                   const char *json_config_additional_payload, ha_status_cb cb);
 struct mgos_homeassistant_object_class *mgos_homeassistant_object_class_get(struct mgos_homeassistant_object *o, const char *suffix);
 bool mgos_homeassistant_object_class_send_status(struct mgos_homeassistant_object_class *c);
 bool mgos_homeassistant_object_class_send_config(struct mgos_homeassistant_object_class *c);
 bool mgos_homeassistant_object_class_remove(struct mgos_homeassistant_object_class **c);
+bool mgos_homeassistant_object_class_get_stats(struct mgos_homeassistant_object_class *c, struct mgos_homeassistant_stats *stats);
 
 #ifdef __cplusplus
 }
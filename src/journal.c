@@ -0,0 +1,236 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "journal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef JOURNAL_LOG
+#include "mgos.h"
+#define JOURNAL_LOG(fmt, ...) LOG(LL_ERROR, (fmt, __VA_ARGS__))
+#endif
+
+/* Private prototypes and declarations */
+struct mgos_journal_record {
+  uint32_t crc;  // CRC32 over the rest of the record
+  uint32_t ts;
+  uint16_t len;
+  char name[JOURNAL_NAME_MAX];
+  char payload[JOURNAL_PAYLOAD_MAX];
+} __attribute__((packed));
+
+struct mgos_journal {
+  char *filename;
+  char *pos_filename;  // holds read, so that a reboot during replay resumes there
+  uint32_t max_records;
+  uint32_t records;  // records in the file
+  uint32_t read;     // records in the file that were replayed
+  struct mgos_journal_record *batch;
+  int batch_size;
+  int batch_len;
+  struct mgos_journal_stats stats;
+};
+
+static uint32_t journal_crc32(const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *) data;
+  uint32_t crc = 0xffffffff;
+
+  while (len--) {
+    crc ^= *p++;
+    for (int i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static uint32_t journal_record_crc(const struct mgos_journal_record *r) {
+  return journal_crc32((const char *) r + sizeof(r->crc), sizeof(*r) - sizeof(r->crc));
+}
+
+static void journal_truncate(struct mgos_journal *j) {
+  remove(j->filename);
+  remove(j->pos_filename);
+  j->records = 0;
+  j->read = 0;
+}
+
+static void journal_save_pos(struct mgos_journal *j) {
+  FILE *fp;
+  size_t n = 0;
+
+  if ((fp = fopen(j->pos_filename, "wb"))) {
+    n = fwrite(&j->read, sizeof(j->read), 1, fp);
+    if (0 != fclose(fp)) n = 0;
+  }
+  if (n != 1) {
+    JOURNAL_LOG("Could not write %s", j->pos_filename);
+    j->stats.errors++;
+  }
+}
+
+struct mgos_journal *journal_create(const char *filename, size_t max_bytes, int batch_size) {
+  struct mgos_journal *j;
+  FILE *fp;
+
+  if (!filename || max_bytes < JOURNAL_RECORD_SIZE) return NULL;
+  if (!(j = calloc(1, sizeof(*j)))) return NULL;
+  if (batch_size < 1) batch_size = 1;
+  j->filename = strdup(filename);
+  if ((j->pos_filename = malloc(strlen(filename) + 5))) sprintf(j->pos_filename, "%s.pos", filename);
+  j->max_records = max_bytes / JOURNAL_RECORD_SIZE;
+  j->batch_size = batch_size;
+  j->batch = calloc(batch_size, sizeof(*j->batch));
+  if (!j->filename || !j->pos_filename || !j->batch) {
+    journal_destroy(&j);
+    return NULL;
+  }
+
+  // Records left behind by an earlier boot are replayed too, from where its
+  // replay got to.
+  if ((fp = fopen(filename, "rb"))) {
+    if (0 == fseek(fp, 0, SEEK_END)) {
+      long size = ftell(fp);
+      if (size > 0) j->records = size / JOURNAL_RECORD_SIZE;
+    }
+    fclose(fp);
+  }
+  if ((fp = fopen(j->pos_filename, "rb"))) {
+    uint32_t read;
+    if (1 == fread(&read, sizeof(read), 1, fp) && read <= j->records) j->read = read;
+    fclose(fp);
+  }
+  return j;
+}
+
+bool journal_destroy(struct mgos_journal **j) {
+  if (!j || !*j) return false;
+  journal_flush(*j);
+  if ((*j)->filename) free((*j)->filename);
+  if ((*j)->pos_filename) free((*j)->pos_filename);
+  if ((*j)->batch) free((*j)->batch);
+  free(*j);
+  *j = NULL;
+  return true;
+}
+
+bool journal_append(struct mgos_journal *j, const char *name, double ts, const char *payload, size_t len) {
+  struct mgos_journal_record *r;
+
+  if (!j || !name || !payload) return false;
+  if (len > JOURNAL_PAYLOAD_MAX || strlen(name) >= JOURNAL_NAME_MAX || j->records + j->batch_len >= j->max_records) {
+    j->stats.dropped++;
+    return false;
+  }
+
+  r = &j->batch[j->batch_len++];
+  memset(r, 0, sizeof(*r));
+  r->ts = (uint32_t) ts;
+  r->len = len;
+  strcpy(r->name, name);
+  memcpy(r->payload, payload, len);
+  r->crc = journal_record_crc(r);
+  j->stats.appended++;
+
+  if (j->batch_len >= j->batch_size) return journal_flush(j);
+  return true;
+}
+
+bool journal_flush(struct mgos_journal *j) {
+  FILE *fp;
+  size_t n;
+
+  if (!j) return false;
+  if (j->batch_len == 0) return true;
+
+  if (!(fp = fopen(j->filename, "ab"))) {
+    n = 0;
+  } else {
+    n = fwrite(j->batch, sizeof(*j->batch), j->batch_len, fp);
+    if (0 != fclose(fp)) n = 0;
+  }
+  if (n != (size_t) j->batch_len) {
+    // Records that did not make it are dropped, rather than retried forever.
+    JOURNAL_LOG("Could not write %s: %u of %d records written", j->filename, (unsigned) n, j->batch_len);
+    j->stats.errors++;
+    j->stats.dropped += j->batch_len - n;
+  }
+  // A partial record at the end of the file is skipped upon replay.
+  j->records += n;
+  j->stats.written += n;
+  j->batch_len = 0;
+  return n > 0;
+}
+
+uint32_t journal_pending(struct mgos_journal *j) {
+  if (!j) return 0;
+  return j->records - j->read + j->batch_len;
+}
+
+int journal_replay(struct mgos_journal *j, int max, journal_replay_cb cb, void *user_data) {
+  struct mgos_journal_record r;
+  FILE *fp;
+  int n = 0;
+
+  if (!j || !cb) return -1;
+  journal_flush(j);
+  if (j->read >= j->records) {
+    if (j->records > 0) journal_truncate(j);
+    return 0;
+  }
+
+  if (!(fp = fopen(j->filename, "rb"))) {
+    JOURNAL_LOG("Could not open %s for reading, dropping %u records", j->filename, (unsigned) (j->records - j->read));
+    j->stats.errors++;
+    remove(j->pos_filename);
+    j->records = j->read = 0;
+    return -1;
+  }
+  if (0 != fseek(fp, (long) j->read * JOURNAL_RECORD_SIZE, SEEK_SET)) {
+    j->stats.errors++;
+    fclose(fp);
+    journal_truncate(j);
+    return -1;
+  }
+
+  while (n < max && j->read < j->records) {
+    if (1 != fread(&r, sizeof(r), 1, fp)) {
+      // Truncated file: nothing more to replay.
+      j->records = j->read;
+      break;
+    }
+    j->read++;
+    n++;
+    if (r.crc != journal_record_crc(&r) || r.len > JOURNAL_PAYLOAD_MAX || r.name[JOURNAL_NAME_MAX - 1]) {
+      j->stats.corrupt++;
+      continue;
+    }
+    j->stats.replayed++;
+    cb(r.name, r.ts, r.payload, r.len, user_data);
+  }
+  fclose(fp);
+
+  if (j->read >= j->records)
+    journal_truncate(j);
+  else
+    journal_save_pos(j);
+  return n;
+}
+
+bool journal_get_stats(struct mgos_journal *j, struct mgos_journal_stats *stats) {
+  if (!j || !stats) return false;
+  *stats = j->stats;
+  return true;
+}
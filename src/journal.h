@@ -0,0 +1,75 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* An append-only journal of small payloads in a file, meant to hold statuses
+ * across long MQTT outages and reboots.
+ *
+ * Records have a fixed size of JOURNAL_RECORD_SIZE bytes and carry a name, a
+ * timestamp and a CRC32, so that a record torn by a reboot is skipped rather
+ * than replayed. Appended records are held in RAM and written batch_size at a
+ * time, to limit flash wear. The file is capped at max_bytes, beyond which
+ * appends are dropped.
+ *
+ * Replay returns records in the order they were appended, a few at a time.
+ * Once all of them are replayed the file is removed. Until then, the number of
+ * records replayed is written to <filename>.pos after every call, so that
+ * after a reboot replay resumes there. Replay is at least once: records of a
+ * call interrupted by a reboot are replayed again.
+ *
+ * struct mgos_journal *j = journal_create("/ha.journal", 16384, 8);
+ * journal_append(j, "temp0", mg_time(), "{\"t\":21.5}", 10);
+ * ...
+ * while (journal_pending(j)) journal_replay(j, 5, replay_cb, NULL);
+ * journal_destroy(&j);
+ *
+ * Failed file operations are counted in mgos_journal_stats, and logged with
+ * JOURNAL_LOG, which is LOG(LL_ERROR, ...) unless defined at build time. With
+ * it defined, the journal depends on the C library only, so it also runs
+ * against a plain directory on a host.
+ */
+
+#define JOURNAL_RECORD_SIZE 128
+#define JOURNAL_NAME_MAX 21  // object names of up to 20 characters, and a NUL
+#define JOURNAL_PAYLOAD_MAX (JOURNAL_RECORD_SIZE - 10 - JOURNAL_NAME_MAX)
+
+struct mgos_journal;
+
+struct mgos_journal_stats {
+  uint32_t appended;  // records appended
+  uint32_t dropped;   // records dropped because the file was full, or the payload too large
+  uint32_t written;   // records written to the file
+  uint32_t replayed;  // records replayed
+  uint32_t corrupt;   // records skipped because of a CRC mismatch
+  uint32_t errors;    // failed file operations
+};
+
+typedef void (*journal_replay_cb)(const char *name, uint32_t ts, const char *payload, size_t len, void *user_data);
+
+struct mgos_journal *journal_create(const char *filename, size_t max_bytes, int batch_size);
+bool journal_destroy(struct mgos_journal **j);
+bool journal_append(struct mgos_journal *j, const char *name, double ts, const char *payload, size_t len);
+// Writes out the batched records.
+bool journal_flush(struct mgos_journal *j);
+// Returns the number of records appended and not replayed yet.
+uint32_t journal_pending(struct mgos_journal *j);
+// Flushes the batch, calls cb for up to max records and returns the number of
+// records read, or -1 on error. Removes the file once all records are replayed.
+int journal_replay(struct mgos_journal *j, int max, journal_replay_cb cb, void *user_data);
+bool journal_get_stats(struct mgos_journal *j, struct mgos_journal_stats *stats);
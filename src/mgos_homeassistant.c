@@ -16,11 +16,14 @@
 
 #include "mgos_homeassistant.h"
 
+#include "journal.h"
 #include "mgos.h"
 #include "mgos_homeassistant_automation.h"
 #include "mgos_homeassistant_barometer.h"
 #include "mgos_homeassistant_bh1750.h"
+#include "mgos_homeassistant_diagnostics.h"
 #include "mgos_homeassistant_gpio.h"
+#include "mgos_homeassistant_scheduler.h"
 #include "mgos_homeassistant_si7021.h"
 #include "mgos_mqtt.h"
 
@@ -57,10 +60,7 @@ static void mgos_homeassistant_mqtt_ev(struct mg_connection *nc, int ev, void *e
   switch (ev) {
     case MG_EV_MQTT_CONNACK: {
       mgos_mqtt_pub(mgos_sys_config_get_device_id(), "online", 6, 0, true);
-      if (user_data) {
-        mgos_homeassistant_send_config((struct mgos_homeassistant *) user_data, true);
-        mgos_homeassistant_send_status((struct mgos_homeassistant *) user_data);
-      }
+      if (user_data) mgos_homeassistant_announce((struct mgos_homeassistant *) user_data);
       break;
     }
   }
@@ -69,30 +69,21 @@ static void mgos_homeassistant_mqtt_ev(struct mg_connection *nc, int ev, void *e
   (void) user_data;
 }
 
-static bool mgos_homeassistant_automation_run_status(struct mgos_homeassistant_object *o) {
-  struct mgos_homeassistant_automation *a;
-  struct mgos_homeassistant_automation_data_status d;
+static bool mgos_homeassistant_run_status(struct mgos_homeassistant_object *o) {
   if (!o || !o->ha) return false;
 
-  d.object = o->object_name;
+  // NULL terminate the status, without making the terminator part of it.
   mbuf_append(&o->status, "\0", 1);
-  d.status = o->status.buf;
-  LOG(LL_DEBUG, ("Running automations for trigger object=%s status=%s", d.object, d.status));
-
-  SLIST_FOREACH(a, &o->ha->automations, entry) {
-    mgos_homeassistant_automation_run(a, TRIGGER_STATUS, &d, o->ha);
-  }
-  return true;
+  o->status.len--;
+  LOG(LL_DEBUG, ("Running automations for trigger object=%s status=%s", o->object_name, o->status.buf));
+  return mgos_homeassistant_automation_run_status(o->ha, o);
 }
 
+// Registered for MGOS_HOMEASSISTANT_EVM_OBJECT_STATUS only.
 static void mgos_homeassistant_handler(struct mgos_homeassistant *ha, const int ev, const void *ev_data, void *user_data) {
   if (!ha) return;
-  LOG(LL_DEBUG, ("Node '%s' event: %d", ha->node_name, ev));
-
-  if (ev == MGOS_HOMEASSISTANT_EV_OBJECT_STATUS) {
-    mgos_homeassistant_automation_run_status((struct mgos_homeassistant_object *) ev_data);
-    return;
-  }
+  mgos_homeassistant_run_status((struct mgos_homeassistant_object *) ev_data);
+  (void) ev;
   (void) user_data;
 }
 
@@ -132,6 +123,7 @@ bool mgos_homeassistant_fromjson(struct mgos_homeassistant *ha, const char *json
   if (name) {
     if (ha->node_name) free(ha->node_name);
     ha->node_name = strdup(name);
+    mgos_homeassistant_update_topics(ha);
   }
 
   // Read providers
@@ -143,11 +135,13 @@ bool mgos_homeassistant_fromjson(struct mgos_homeassistant *ha, const char *json
       LOG(LL_ERROR, ("provider.%.*s config found: add %s to mos.yml, skipping...", key.len, key.ptr, p ? p->module : "the module implementing it"));
   }
 
+  if (mgos_sys_config_get_homeassistant_diagnostics_enable()) mgos_homeassistant_diagnostics_add(ha);
+
   // Read automations
   while ((h = json_next_elem(json, json_sz, h, ".automation", &idx, &val)) != NULL) {
     struct mgos_homeassistant_automation *a;
 
-    if (!(a = mgos_homeassistant_automation_create(val))) {
+    if (!(a = mgos_homeassistant_automation_create(ha, val))) {
       LOG(LL_WARN, ("Failed to add automation, index %d, json follows:%.*s", idx, (int) val.len, val.ptr));
       continue;
     }
@@ -205,10 +199,35 @@ bool mgos_homeassistant_init(void) {
   if (!s_homeassistant) return false;
 
   s_homeassistant->node_name = strdup(mgos_sys_config_get_device_id());
+  s_homeassistant->arena.chunk_size = mgos_sys_config_get_homeassistant_arena_chunk_size();
+  SLIST_INIT(&s_homeassistant->arena.chunks);
   SLIST_INIT(&s_homeassistant->objects);
+  for (int i = 0; i < MGOS_HOMEASSISTANT_INDEX_SIZE; i++) {
+    SLIST_INIT(&s_homeassistant->name_index[i]);
+    SLIST_INIT(&s_homeassistant->suffix_index[i]);
+    SLIST_INIT(&s_homeassistant->names[i]);
+    SLIST_INIT(&s_homeassistant->trigger_index[i]);
+  }
   SLIST_INIT(&s_homeassistant->automations);
+  STAILQ_INIT(&s_homeassistant->dirty);
+  mbuf_init(&s_homeassistant->aggregate.payload, 0);
   SLIST_INIT(&s_homeassistant->handlers);
-  mgos_homeassistant_add_handler(s_homeassistant, mgos_homeassistant_handler, NULL);
+  if (mgos_sys_config_get_homeassistant_journal_file() && mgos_sys_config_get_homeassistant_journal_file()[0]) {
+    s_homeassistant->journal = journal_create(mgos_sys_config_get_homeassistant_journal_file(), mgos_sys_config_get_homeassistant_journal_bytes(),
+                                              mgos_sys_config_get_homeassistant_journal_batch());
+    if (journal_pending(s_homeassistant->journal) > 0)
+      LOG(LL_INFO, ("Journal %s holds %u records", mgos_sys_config_get_homeassistant_journal_file(),
+                    (unsigned) journal_pending(s_homeassistant->journal)));
+  }
+  s_homeassistant->scheduler = mgos_homeassistant_scheduler_create();
+  if (mgos_sys_config_get_homeassistant_automation_queue_size() > 0) {
+    s_homeassistant->automation_queue = mgos_homeassistant_automation_queue_create(mgos_sys_config_get_homeassistant_automation_queue_size(),
+                                                                                   mgos_sys_config_get_homeassistant_automation_runs_per_tick(),
+                                                                                   mgos_sys_config_get_homeassistant_automation_max_depth());
+  }
+  mgos_homeassistant_add_handler_mask(s_homeassistant, mgos_homeassistant_handler, MGOS_HOMEASSISTANT_EVM_OBJECT_STATUS, NULL, NULL);
+  mgos_homeassistant_add_handler_mask(s_homeassistant, mgos_homeassistant_automation_handler,
+                                      MGOS_HOMEASSISTANT_EVM_OBJECT_ADD | MGOS_HOMEASSISTANT_EVM_OBJECT_REMOVE, NULL, NULL);
 
   mgos_mqtt_add_global_handler(mgos_homeassistant_mqtt_ev, s_homeassistant);
   mgos_mqtt_set_connect_fn(mgos_homeassistant_mqtt_connect, NULL);
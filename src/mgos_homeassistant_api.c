@@ -16,6 +16,7 @@
 
 #include "mgos_homeassistant_api.h"
 
+#include "journal.h"
 #include "mgos.h"
 #include "mgos_config.h"
 #include "mgos_mqtt.h"
@@ -85,15 +86,195 @@ static bool mgos_homeassistant_isvalid_name(const char *s) {
   return true;
 }
 
-static bool mgos_homeassistant_exists_objectname(struct mgos_homeassistant *ha, const char *s) {
-  struct mgos_homeassistant_object *o;
-  if (!ha || !s) return false;
+// Case-insensitive djb2 hash of the full name, used by the name index.
+static uint32_t name_hash(const char *s, size_t len) {
+  uint32_t h = 5381;
+  while (len--) h = (h << 5) + h + (uint32_t) tolower((int) *s++);
+  return h;
+}
 
-  SLIST_FOREACH(o, &ha->objects, entry) {
-    if (0 == strcasecmp(s, o->object_name)) return true;
+// FNV-1a hash of a buffer, used to detect changes in rendered payloads.
+static uint32_t content_hash(const char *s, size_t len) {
+  uint32_t h = 2166136261u;
+  while (len--) {
+    h ^= (uint8_t) *s++;
+    h *= 16777619u;
   }
+  return h;
+}
 
-  return false;
+// Case-sensitive djb2 hash of the last MGOS_HOMEASSISTANT_SUFFIX_LEN
+// characters of s, used by the suffix index. Caller ensures len is at least
+// MGOS_HOMEASSISTANT_SUFFIX_LEN.
+static uint32_t suffix_hash(const char *s, size_t len) {
+  uint32_t h = 5381;
+  for (size_t i = len - MGOS_HOMEASSISTANT_SUFFIX_LEN; i < len; i++) h = (h << 5) + h + (uint32_t) s[i];
+  return h;
+}
+
+struct mgos_homeassistant_arena_chunk {
+  size_t size;  // usable bytes after the header
+  size_t used;
+  SLIST_ENTRY(mgos_homeassistant_arena_chunk) entry;
+};
+
+#define ARENA_ALIGN 8
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+#define ARENA_HDR ARENA_ROUND(sizeof(struct mgos_homeassistant_arena_chunk))
+#define ARENA_DATA(ch) ((char *) (ch) + ARENA_HDR)
+
+// Frees all chunks but the current one, which is reused from the start.
+static void mgos_homeassistant_arena_reset(struct mgos_homeassistant *ha) {
+  struct mgos_homeassistant_arena *a = &ha->arena;
+  struct mgos_homeassistant_arena_chunk *ch = SLIST_FIRST(&a->chunks);
+
+  if (!ch) return;
+  SLIST_REMOVE_HEAD(&a->chunks, entry);
+  while (!SLIST_EMPTY(&a->chunks)) {
+    struct mgos_homeassistant_arena_chunk *old = SLIST_FIRST(&a->chunks);
+    SLIST_REMOVE_HEAD(&a->chunks, entry);
+    free(old);
+  }
+  ch->used = 0;
+  SLIST_INSERT_HEAD(&a->chunks, ch, entry);
+  a->stats.reserved = ch->size;
+  a->stats.chunks = 1;
+  a->stats.used = 0;
+  a->stats.freed = 0;
+  a->stats.resets++;
+  LOG(LL_DEBUG, ("Reset arena of node '%s', peak %u bytes", ha->node_name, (unsigned) a->stats.peak));
+}
+
+// Returns zeroed memory from the node's arena, or from the heap if the arena
+// is disabled or size does not fit in a chunk.
+static void *mgos_homeassistant_alloc(struct mgos_homeassistant *ha, size_t size) {
+  struct mgos_homeassistant_arena *a = &ha->arena;
+  struct mgos_homeassistant_arena_chunk *ch;
+  size_t need = ARENA_ROUND(size);
+  void *p;
+
+  if (a->chunk_size <= ARENA_HDR || need > a->chunk_size - ARENA_HDR) return calloc(1, size);
+
+  ch = SLIST_FIRST(&a->chunks);
+  if (!ch || ch->size - ch->used < need) {
+    if (!(ch = malloc(a->chunk_size))) return NULL;
+    ch->size = a->chunk_size - ARENA_HDR;
+    ch->used = 0;
+    SLIST_INSERT_HEAD(&a->chunks, ch, entry);
+    a->stats.reserved += ch->size;
+    a->stats.chunks++;
+  }
+  p = ARENA_DATA(ch) + ch->used;
+  ch->used += need;
+  memset(p, 0, size);
+  a->stats.used += need;
+  a->stats.allocs++;
+  if (a->stats.used > a->stats.peak) a->stats.peak = a->stats.used;
+  return p;
+}
+
+static char *mgos_homeassistant_strdup(struct mgos_homeassistant *ha, const char *s) {
+  size_t len = strlen(s) + 1;
+  char *p = mgos_homeassistant_alloc(ha, len);
+  if (p) memcpy(p, s, len);
+  return p;
+}
+
+// Returns memory to wherever mgos_homeassistant_alloc() got it from. Caller
+// passes the size that was allocated.
+static void mgos_homeassistant_free(struct mgos_homeassistant *ha, void *p, size_t size) {
+  struct mgos_homeassistant_arena *a = &ha->arena;
+  struct mgos_homeassistant_arena_chunk *ch;
+  size_t need = ARENA_ROUND(size);
+
+  if (!p) return;
+  SLIST_FOREACH(ch, &a->chunks, entry) {
+    if ((uintptr_t) p >= (uintptr_t) ARENA_DATA(ch) && (uintptr_t) p < (uintptr_t) ARENA_DATA(ch) + ch->size) break;
+  }
+  if (!ch) {
+    free(p);
+    return;
+  }
+
+  a->stats.used -= need;
+  a->stats.allocs--;
+  // The most recent allocation is handed back to the chunk directly.
+  if (ch == SLIST_FIRST(&a->chunks) && (char *) p + need == ARENA_DATA(ch) + ch->used) {
+    ch->used -= need;
+  } else {
+    a->stats.freed += need;
+  }
+  if (a->stats.allocs == 0) mgos_homeassistant_arena_reset(ha);
+}
+
+// Returns the interned copy of s, adding it to the node's name table if need be.
+static char *mgos_homeassistant_name_intern(struct mgos_homeassistant *ha, const char *s) {
+  size_t len = strlen(s);
+  uint32_t hash = content_hash(s, len);
+  struct mgos_homeassistant_name *n;
+
+  SLIST_FOREACH(n, &ha->names[hash % MGOS_HOMEASSISTANT_INDEX_SIZE], entry) {
+    if (n->hash == hash && 0 == strcmp(n->str, s)) {
+      n->refs++;
+      return n->str;
+    }
+  }
+  if (!(n = mgos_homeassistant_alloc(ha, sizeof(*n) + len + 1))) return NULL;
+  n->hash = hash;
+  n->refs = 1;
+  memcpy(n->str, s, len + 1);
+  SLIST_INSERT_HEAD(&ha->names[hash % MGOS_HOMEASSISTANT_INDEX_SIZE], n, entry);
+  return n->str;
+}
+
+// Drops a reference to a string returned by mgos_homeassistant_name_intern().
+static void mgos_homeassistant_name_release(struct mgos_homeassistant *ha, char *s) {
+  struct mgos_homeassistant_name *n;
+  size_t len;
+
+  if (!s) return;
+  n = (struct mgos_homeassistant_name *) (s - offsetof(struct mgos_homeassistant_name, str));
+  if (--n->refs > 0) return;
+  len = strlen(n->str);
+  SLIST_REMOVE(&ha->names[n->hash % MGOS_HOMEASSISTANT_INDEX_SIZE], n, mgos_homeassistant_name, entry);
+  mgos_homeassistant_free(ha, n, sizeof(*n) + len + 1);
+}
+
+// Frees an additional payload, unless it was borrowed.
+static void mgos_homeassistant_payload_free(struct mgos_homeassistant *ha, char *payload, bool payload_static) {
+  if (!payload || payload_static) return;
+  mgos_homeassistant_free(ha, payload, strlen(payload) + 1);
+}
+
+// Exact, case-insensitive lookup of a name that need not be NULL terminated.
+static struct mgos_homeassistant_object *mgos_homeassistant_object_get_exact_n(struct mgos_homeassistant *ha, const char *name, size_t len) {
+  struct mgos_homeassistant_object *o = NULL;
+
+  SLIST_FOREACH(o, &ha->name_index[name_hash(name, len) % MGOS_HOMEASSISTANT_INDEX_SIZE], name_entry) {
+    if (strlen(o->object_name) == len && 0 == strncasecmp(name, o->object_name, len)) return o;
+  }
+  return NULL;
+}
+
+static void mgos_homeassistant_object_index_add(struct mgos_homeassistant *ha, struct mgos_homeassistant_object *o) {
+  size_t len = strlen(o->object_name);
+
+  SLIST_INSERT_HEAD(&ha->name_index[name_hash(o->object_name, len) % MGOS_HOMEASSISTANT_INDEX_SIZE], o, name_entry);
+  // Names shorter than the suffix key can only match short suffixes, which are served from ha->objects.
+  if (len < MGOS_HOMEASSISTANT_SUFFIX_LEN) return;
+  SLIST_INSERT_HEAD(&ha->suffix_index[suffix_hash(o->object_name, len) % MGOS_HOMEASSISTANT_INDEX_SIZE], o, suffix_entry);
+}
+
+static void mgos_homeassistant_object_index_remove(struct mgos_homeassistant *ha, struct mgos_homeassistant_object *o) {
+  size_t len = strlen(o->object_name);
+
+  SLIST_REMOVE(&ha->name_index[name_hash(o->object_name, len) % MGOS_HOMEASSISTANT_INDEX_SIZE], o, mgos_homeassistant_object, name_entry);
+  if (len < MGOS_HOMEASSISTANT_SUFFIX_LEN) return;
+  SLIST_REMOVE(&ha->suffix_index[suffix_hash(o->object_name, len) % MGOS_HOMEASSISTANT_INDEX_SIZE], o, mgos_homeassistant_object, suffix_entry);
+}
+
+static bool mgos_homeassistant_exists_objectname(struct mgos_homeassistant *ha, const char *s) {
+  return mgos_homeassistant_object_get_exact(ha, s) != NULL;
 }
 
 bool mgos_homeassistant_object_generate_name(struct mgos_homeassistant *ha, const char *prefix, char *name, int namelen) {
@@ -117,37 +298,146 @@ static bool mgos_homeassistant_exists_classname(struct mgos_homeassistant_object
   return false;
 }
 
-static struct mgos_homeassistant_object_cmd *mgos_homeassistant_object_get_cmd(struct mgos_homeassistant_object *o, const char *s) {
+// Note: s need not be NULL terminated, len is its length. s == NULL selects the default command.
+static struct mgos_homeassistant_object_cmd *mgos_homeassistant_object_get_cmd_n(struct mgos_homeassistant_object *o, const char *s, size_t len) {
   struct mgos_homeassistant_object_cmd *c;
+  uint32_t hash;
   if (!o) return NULL;
 
+  hash = s ? name_hash(s, len) : 0;
   SLIST_FOREACH(c, &o->cmds, entry) {
     if (c->cmd_name == NULL && s == NULL) return c;
     if (c->cmd_name == NULL || s == NULL) continue;
-    if (0 == strcasecmp(s, c->cmd_name)) return c;
+    if (c->cmd_hash == hash && c->cmd_len == len && 0 == strncasecmp(s, c->cmd_name, len)) return c;
   }
   return NULL;
 }
 
-static struct mgos_homeassistant_object_attr *mgos_homeassistant_object_get_attr(struct mgos_homeassistant_object *o, const char *s) {
+static struct mgos_homeassistant_object_cmd *mgos_homeassistant_object_get_cmd(struct mgos_homeassistant_object *o, const char *s) {
+  return mgos_homeassistant_object_get_cmd_n(o, s, s ? strlen(s) : 0);
+}
+
+// Note: s need not be NULL terminated, len is its length. s == NULL selects the default attribute.
+static struct mgos_homeassistant_object_attr *mgos_homeassistant_object_get_attr_n(struct mgos_homeassistant_object *o, const char *s, size_t len) {
   struct mgos_homeassistant_object_attr *a;
+  uint32_t hash;
   if (!o) return NULL;
 
+  hash = s ? name_hash(s, len) : 0;
   SLIST_FOREACH(a, &o->attrs, entry) {
     if (a->attr_name == NULL && s == NULL) return a;
     if (a->attr_name == NULL || s == NULL) continue;
-    if (0 == strcasecmp(s, a->attr_name)) return a;
+    if (a->attr_hash == hash && a->attr_len == len && 0 == strncasecmp(s, a->attr_name, len)) return a;
   }
   return NULL;
 }
 
+static struct mgos_homeassistant_object_attr *mgos_homeassistant_object_get_attr(struct mgos_homeassistant_object *o, const char *s) {
+  return mgos_homeassistant_object_get_attr_n(o, s, s ? strlen(s) : 0);
+}
+
+// Publishes a config or status message, accounting for it in the node counters.
+static void mgos_homeassistant_pub(struct mgos_homeassistant *ha, const char *topic, const char *payload, size_t len, bool retain) {
+  mgos_mqtt_pub(topic, payload, len, 0, retain);
+  ha->pub_msgs++;
+  ha->pub_bytes += len;
+}
+
+// Returns the bit of the event in MGOS_HOMEASSISTANT_EVM_*, or -1 for unknown events.
+static int mgos_homeassistant_ev_index(int ev) {
+  switch (ev) {
+    case MGOS_HOMEASSISTANT_EV_ADD_HANDLER:
+      return 0;
+    case MGOS_HOMEASSISTANT_EV_CLEAR:
+      return 1;
+    case MGOS_HOMEASSISTANT_EV_OBJECT_ADD:
+      return 2;
+    case MGOS_HOMEASSISTANT_EV_OBJECT_STATUS:
+      return 3;
+    case MGOS_HOMEASSISTANT_EV_OBJECT_CMD:
+      return 4;
+    case MGOS_HOMEASSISTANT_EV_OBJECT_ATTR:
+      return 5;
+    case MGOS_HOMEASSISTANT_EV_OBJECT_REMOVE:
+      return 6;
+    case MGOS_HOMEASSISTANT_EV_CLASS_ADD:
+      return 7;
+    case MGOS_HOMEASSISTANT_EV_CLASS_REMOVE:
+      return 8;
+    case MGOS_HOMEASSISTANT_EV_AUTOMATION_RUN:
+      return 9;
+  }
+  return -1;
+}
+
+// Returns the object an event is about, or NULL for node wide events.
+static const struct mgos_homeassistant_object *mgos_homeassistant_ev_object(int ev, const void *ev_data) {
+  if (!ev_data) return NULL;
+  switch (ev) {
+    case MGOS_HOMEASSISTANT_EV_OBJECT_ADD:
+    case MGOS_HOMEASSISTANT_EV_OBJECT_STATUS:
+    case MGOS_HOMEASSISTANT_EV_OBJECT_REMOVE:
+      return (const struct mgos_homeassistant_object *) ev_data;
+    case MGOS_HOMEASSISTANT_EV_OBJECT_CMD:
+      return ((const struct mgos_homeassistant_object_cmd *) ev_data)->object;
+    case MGOS_HOMEASSISTANT_EV_OBJECT_ATTR:
+      return ((const struct mgos_homeassistant_object_attr *) ev_data)->object;
+    case MGOS_HOMEASSISTANT_EV_CLASS_ADD:
+    case MGOS_HOMEASSISTANT_EV_CLASS_REMOVE:
+      return ((const struct mgos_homeassistant_object_class *) ev_data)->object;
+  }
+  return NULL;
+}
+
+// Unlinks handler h from the node and its event arrays, and frees it.
+static void mgos_homeassistant_handler_free(struct mgos_homeassistant *ha, struct mgos_homeassistant_handler *h) {
+  for (int i = 0; i < MGOS_HOMEASSISTANT_EV_COUNT; i++) {
+    int n = 0;
+    for (int j = 0; j < ha->ev_handlers_len[i]; j++)
+      if (ha->ev_handlers[i][j] != h) ha->ev_handlers[i][n++] = ha->ev_handlers[i][j];
+    ha->ev_handlers_len[i] = n;
+  }
+  SLIST_REMOVE(&ha->handlers, h, mgos_homeassistant_handler, entry);
+  free(h);
+}
+
+// Handlers may remove objects, and with them handlers, or add handlers. So
+// that the event arrays keep their order while they are walked, removed
+// handlers are only marked until the outermost call is done, and added ones
+// are skipped past.
 bool mgos_homeassistant_call_handlers(struct mgos_homeassistant *ha, int ev, void *ev_data) {
   struct mgos_homeassistant_handler *h;
+  const struct mgos_homeassistant_object *o;
+  int idx;
   if (!ha) return false;
 
-  LOG(LL_DEBUG, ("Node '%s' event: %d", ha->node_name, ev));
-  SLIST_FOREACH(h, &ha->handlers, entry) {
-    h->ev_handler(ha, ev, ev_data, h->user_data);
+  // Status events are too frequent to log.
+  if (ev != MGOS_HOMEASSISTANT_EV_OBJECT_STATUS) LOG(LL_DEBUG, ("Node '%s' event: %d", ha->node_name, ev));
+
+  ha->dispatching++;
+  if ((idx = mgos_homeassistant_ev_index(ev)) < 0) {
+    // Events not known here go to handlers that asked for all events.
+    SLIST_FOREACH(h, &ha->handlers, entry) {
+      if (h->removed) continue;
+      if (h->ev_mask == MGOS_HOMEASSISTANT_EVM_ALL && !h->object) h->ev_handler(ha, ev, ev_data, h->user_data);
+    }
+  } else {
+    o = mgos_homeassistant_ev_object(ev, ev_data);
+    for (int i = 0; i < ha->ev_handlers_len[idx]; i++) {
+      h = ha->ev_handlers[idx][i];
+      if (h->removed || (h->object && h->object != o)) continue;
+      h->ev_handler(ha, ev, ev_data, h->user_data);
+      // Handlers added meanwhile went in front of h.
+      while (ha->ev_handlers[idx][i] != h) i++;
+    }
+  }
+  if (--ha->dispatching == 0 && ha->handlers_removed) {
+    struct mgos_homeassistant_handler *h_tmp;
+
+    ha->handlers_removed = false;
+    SLIST_FOREACH_SAFE(h, &ha->handlers, entry, h_tmp) {
+      if (h->removed) mgos_homeassistant_handler_free(ha, h);
+    }
   }
   return true;
 }
@@ -192,6 +482,57 @@ static char *gen_friendlyname(struct mbuf *m, const struct mgos_homeassistant_ob
   return m->buf;
 }
 
+// Builds all topics of the object into t, in a single allocation.
+static bool mgos_homeassistant_object_build_topics(struct mgos_homeassistant_object *o, struct mgos_homeassistant_object_topics *t) {
+  size_t cmd, attr, log, sub, config;
+  struct mbuf m;
+
+  mbuf_init(&m, 200);
+  gen_topicprefix(&m, o);
+  t->prefix_len = m.len;
+  mbuf_append(&m, "\0", 1);
+  cmd = m.len;
+  gen_topicprefix(&m, o);
+  mbuf_append(&m, "/cmd\0", 5);
+  attr = m.len;
+  gen_topicprefix(&m, o);
+  mbuf_append(&m, "/attr\0", 6);
+  log = m.len;
+  gen_topicprefix(&m, o);
+  mbuf_append(&m, "/log\0", 5);
+  sub = m.len;
+  gen_topicprefix(&m, o);
+  mbuf_append(&m, "/#\0", 3);
+  config = m.len;
+  gen_configtopic(&m, o, NULL);
+  mbuf_append(&m, "\0", 1);
+  mbuf_trim(&m);
+  if (!m.buf) return false;
+
+  t->buf = m.buf;
+  t->prefix = m.buf;
+  t->cmd = m.buf + cmd;
+  t->attr = m.buf + attr;
+  t->log = m.buf + log;
+  t->sub = m.buf + sub;
+  t->config = m.buf + config;
+  return true;
+}
+
+static bool mgos_homeassistant_object_class_build_topics(struct mgos_homeassistant_object_class *c) {
+  struct mbuf m;
+
+  mbuf_init(&m, 100);
+  gen_configtopic(&m, c->object, c);
+  mbuf_append(&m, "\0", 1);
+  mbuf_trim(&m);
+  if (!m.buf) return false;
+
+  if (c->config_topic) free(c->config_topic);
+  c->config_topic = m.buf;
+  return true;
+}
+
 static bool endswith(const char *str, size_t str_len, const char *suffix) {
   if (!str || !suffix) return false;
   size_t suffix_len = strlen(suffix);
@@ -199,90 +540,277 @@ static bool endswith(const char *str, size_t str_len, const char *suffix) {
   return strncmp(str + str_len - suffix_len, suffix, suffix_len) == 0;
 }
 
-static void mgos_homeassistant_mqtt_cb(struct mg_connection *nc, const char *topic, int topic_len, const char *msg, int msg_len, void *ud) {
-  struct mgos_homeassistant_object *o = (struct mgos_homeassistant_object *) ud;
+static bool mgos_homeassistant_object_publish_status(struct mgos_homeassistant_object *o, bool force);
+static bool mgos_homeassistant_object_call_cmd(struct mgos_homeassistant_object_cmd *c, const char *payload, const int payload_len);
+static bool mgos_homeassistant_object_call_attr(struct mgos_homeassistant_object_attr *a, const char *payload, const int payload_len);
+
+// Routes an MQTT message to the object it was addressed to. The path is the
+// remainder of the topic after the object's topic prefix, for example
+// '/cmd/schedule' or '/stat'. Neither path nor msg are NULL terminated.
+static void mgos_homeassistant_object_dispatch(struct mgos_homeassistant_object *o, const char *path, int path_len, const char *msg, int msg_len) {
+  const char *name = NULL;
+  int name_len = 0;
+  bool is_cmd;
+
   if (!o) return;
 
-  LOG(LL_DEBUG, ("Received MQTT for object '%s': topic='%.*s' payload='%.*s'", o->object_name, topic_len, topic, msg_len, msg));
-  if (endswith(topic, (size_t) topic_len, "/stat")) {
-    mgos_homeassistant_object_send_status(o);
+  LOG(LL_DEBUG, ("Received MQTT for object '%s': path='%.*s' payload='%.*s'", o->object_name, path_len, path, msg_len, msg));
+  if (endswith(path, (size_t) path_len, "/stat")) {
+    mgos_homeassistant_object_refresh_status(o);
     return;
   }
 
-  struct mbuf mbuf_topic;
-  mbuf_init(&mbuf_topic, 100);
-  gen_topicprefix(&mbuf_topic, o);
-
-  mbuf_append(&mbuf_topic, "/cmd", 4);
-  if ((topic_len >= (int) mbuf_topic.len) && (0 == strncasecmp(topic, mbuf_topic.buf, mbuf_topic.len))) {
-    int cmd_len = topic_len - mbuf_topic.len;
-    const char *cmdp = topic + mbuf_topic.len;
-    mbuf_free(&mbuf_topic);
+  if (path_len >= 4 && 0 == strncasecmp(path, "/cmd", 4)) {
+    is_cmd = true;
+    name = path + 4;
+    name_len = path_len - 4;
+  } else if (path_len >= 5 && 0 == strncasecmp(path, "/attr", 5)) {
+    is_cmd = false;
+    name = path + 5;
+    name_len = path_len - 5;
+  } else {
+    return;
+  }
 
-    if (!cmdp || (cmd_len == 0)) {
-      LOG(LL_DEBUG, ("Issuing command '(default)' on object '%s'", o->object_name));
-      mgos_homeassistant_object_cmd(o, NULL, msg, msg_len);
+  if (name_len > 0) {
+    if (*name != '/') {
+      LOG(LL_ERROR, ("Malformed %s path, expecting '/'", is_cmd ? "command" : "attribute"));
       return;
     }
-    if (*cmdp != '/') {
-      LOG(LL_ERROR, ("Malformed command path, expecting '/'"));
+    name_len--;
+    name++;  // chop of '/'
+  }
+  if (name_len == 0) name = NULL;
+
+  LOG(LL_DEBUG,
+      ("Issuing %s '%.*s' on object '%s'", is_cmd ? "command" : "attribute", name ? name_len : 9, name ? name : "(default)", o->object_name));
+  if (is_cmd) {
+    struct mgos_homeassistant_object_cmd *c;
+    if (!(c = mgos_homeassistant_object_get_cmd_n(o, name, name_len))) {
+      LOG(LL_WARN, ("No command '%.*s' on object '%s'", name ? name_len : 9, name ? name : "(default)", o->object_name));
       return;
     }
-    cmd_len--;
-    cmdp++;  // chop of '/'
-    if (cmd_len == 0) {
-      LOG(LL_DEBUG, ("Issuing command '(default)' on object '%s'", o->object_name));
-      mgos_homeassistant_object_cmd(o, NULL, msg, msg_len);
+    mgos_homeassistant_object_call_cmd(c, msg, msg_len);
+  } else {
+    struct mgos_homeassistant_object_attr *a;
+    if (!(a = mgos_homeassistant_object_get_attr_n(o, name, name_len))) {
+      LOG(LL_WARN, ("No attribute '%.*s' on object '%s'", name ? name_len : 9, name ? name : "(default)", o->object_name));
       return;
     }
-    LOG(LL_DEBUG, ("Issuing command '%.*s' on object '%s'", (int) cmd_len, cmdp, o->object_name));
-
-    // mgos_homeassistant_object_cmd() expects NULL terminated string.
-    char *cmd = malloc(cmd_len + 1);
-    memcpy(cmd, cmdp, cmd_len);
-    cmd[cmd_len] = 0;
-    mgos_homeassistant_object_cmd(o, cmd, msg, msg_len);
-    free(cmd);
-    return;
+    mgos_homeassistant_object_call_attr(a, msg, msg_len);
   }
+}
 
-  mbuf_topic.len -= 4;
-  mbuf_append(&mbuf_topic, "/attr", 5);
-  if ((topic_len >= (int) mbuf_topic.len) && (0 == strncasecmp(topic, mbuf_topic.buf, mbuf_topic.len))) {
-    int attr_len = topic_len - mbuf_topic.len;
-    const char *attrp = topic + mbuf_topic.len;
-    mbuf_free(&mbuf_topic);
+// Per-object subscription handler, for '<topic_prefix>/#'.
+static void mgos_homeassistant_mqtt_cb(struct mg_connection *nc, const char *topic, int topic_len, const char *msg, int msg_len, void *ud) {
+  struct mgos_homeassistant_object *o = (struct mgos_homeassistant_object *) ud;
+  if (!o) return;
 
-    if (!attrp || (attr_len == 0)) {
-      LOG(LL_DEBUG, ("Issuing attribute '(default)' on object '%s'", o->object_name));
-      mgos_homeassistant_object_attr(o, NULL, msg, msg_len);
-      return;
-    }
-    if (*attrp != '/') {
-      LOG(LL_ERROR, ("Malformed attribute path, expecting '/'"));
-      return;
-    }
-    attr_len--;
-    attrp++;  // chop of '/'
-    if (attr_len == 0) {
-      LOG(LL_DEBUG, ("Issuing attribute '(default)' on object '%s'", o->object_name));
-      mgos_homeassistant_object_attr(o, NULL, msg, msg_len);
-      return;
+  if ((topic_len >= (int) o->topics.prefix_len) && (0 == strncasecmp(topic, o->topics.prefix, o->topics.prefix_len))) {
+    mgos_homeassistant_object_dispatch(o, topic + o->topics.prefix_len, topic_len - o->topics.prefix_len, msg, msg_len);
+  }
+  (void) nc;
+}
+
+// Node-wide subscription handler, for '<node>/#'. The topic is split into its
+// '<node>/<component>/<object>' segments in place: the component is matched
+// against the component table and the object is resolved through the node's
+// name index, so no memory is allocated per message.
+static void mgos_homeassistant_node_mqtt_cb(struct mg_connection *nc, const char *topic, int topic_len, const char *msg, int msg_len, void *ud) {
+  struct mgos_homeassistant *ha = (struct mgos_homeassistant *) ud;
+  struct mgos_homeassistant_object *o;
+  const char *p = topic, *end = topic + topic_len, *seg;
+  enum mgos_homeassistant_component component = COMPONENT_NONE;
+  size_t node_len;
+
+  if (!ha || !ha->node_name) return;
+
+  node_len = strlen(ha->node_name);
+  if ((size_t) topic_len <= node_len || 0 != strncasecmp(topic, ha->node_name, node_len) || topic[node_len] != '/') return;
+  p += node_len + 1;
+
+  for (seg = p; p < end && *p != '/'; p++) {
+  }
+  for (size_t i = 1; i <= HA_COMPONENT_MAX; i++) {
+    if (strlen(ha_components[i].name) == (size_t)(p - seg) && 0 == strncasecmp(seg, ha_components[i].name, p - seg)) {
+      component = (enum mgos_homeassistant_component) i;
+      break;
     }
-    LOG(LL_DEBUG, ("Issuing attribute '%.*s' on object '%s'", (int) attr_len, attrp, o->object_name));
-
-    // mgos_homeassistant_object_attr() expects NULL terminated string.
-    char *attr = malloc(attr_len + 1);
-    memcpy(attr, attrp, attr_len);
-    attr[attr_len] = 0;
-    mgos_homeassistant_object_attr(o, attr, msg, msg_len);
-    free(attr);
-    return;
   }
-  mbuf_free(&mbuf_topic);
+  if (component == COMPONENT_NONE || p == end) return;
+  p++;
+
+  for (seg = p; p < end && *p != '/'; p++) {
+  }
+  if (!(o = mgos_homeassistant_object_get_exact_n(ha, seg, p - seg)) || o->component != component) return;
+
+  mgos_homeassistant_object_dispatch(o, p, end - p, msg, msg_len);
   (void) nc;
 }
 
+// Subscribes to '<node>/#' once for the whole node, replacing an earlier node
+// subscription if the node name has changed since.
+static void mgos_homeassistant_node_subscribe(struct mgos_homeassistant *ha) {
+  struct mbuf mbuf_topic;
+
+  mbuf_init(&mbuf_topic, 100);
+  mbuf_append(&mbuf_topic, ha->node_name, strlen(ha->node_name));
+  mbuf_append(&mbuf_topic, "/#", 2);
+  mbuf_append_nul(&mbuf_topic);
+
+  if (ha->node_topic && 0 == strcmp(ha->node_topic, mbuf_topic.buf)) goto exit;
+  if (ha->node_topic) {
+    if (mgos_mqtt_global_is_connected()) mgos_mqtt_unsub(ha->node_topic);
+    free(ha->node_topic);
+  }
+  LOG(LL_DEBUG, ("Subscribing to '%s' for node '%s'", mbuf_topic.buf, ha->node_name));
+  mgos_mqtt_sub(mbuf_topic.buf, mgos_homeassistant_node_mqtt_cb, ha);
+  ha->node_topic = strdup(mbuf_topic.buf);
+exit:
+  mbuf_free(&mbuf_topic);
+}
+
+// Returns true if the object's status should be part of the aggregated status.
+// Components without a status topic or value template cannot be aggregated.
+static bool mgos_homeassistant_aggregate_match(struct mgos_homeassistant_object *o) {
+  struct ha_component_data *hcd = ha_component_data(o->component);
+  const char *p = mgos_sys_config_get_homeassistant_aggregate_objects();
+  size_t len = strlen(o->object_name);
+
+  if (!mgos_sys_config_get_homeassistant_aggregate_enable() || hcd->no_stat_t || hcd->no_val_tpl) return false;
+  if (!p || !*p) return true;
+
+  for (;;) {
+    const char *e = strchr(p, ',');
+    size_t n = e ? (size_t)(e - p) : strlen(p);
+    if (n == len && 0 == strncasecmp(p, o->object_name, n)) return true;
+    if (!e) return false;
+    p = e + 1;
+  }
+}
+
+static const char *mgos_homeassistant_aggregate_topic(struct mgos_homeassistant *ha) {
+  struct mbuf m;
+
+  if (ha->aggregate.topic) return ha->aggregate.topic;
+  mbuf_init(&m, 50);
+  mbuf_append(&m, ha->node_name, strlen(ha->node_name));
+  mbuf_append(&m, "/status\0", 8);
+  ha->aggregate.topic = m.buf;
+  return ha->aggregate.topic;
+}
+
+// Appends ',<payload>' to m, with each 'value_json' in it pointing at the
+// object's member of the aggregated status instead.
+static void mgos_homeassistant_aggregate_payload(struct mbuf *m, const char *payload, const char *object_name) {
+  const char *p = payload, *v;
+
+  mbuf_append(m, ",", 1);
+  while ((v = strstr(p, "value_json")) != NULL) {
+    v += 10;
+    mbuf_append(m, p, v - p);
+    mbuf_append(m, "['", 2);
+    mbuf_append(m, object_name, strlen(object_name));
+    mbuf_append(m, "']", 2);
+    p = v;
+  }
+  mbuf_append(m, p, strlen(p));
+}
+
+// Returns the 'dev' block of the discovery config, rendering it on first use.
+static const char *mgos_homeassistant_device_config(struct mgos_homeassistant *ha) {
+  struct mbuf mbuf_dev;
+  struct json_out dev = JSON_OUT_MBUF(&mbuf_dev);
+
+  if (ha->device_config) return ha->device_config;
+
+  mbuf_init(&mbuf_dev, 150);
+  json_printf(&dev, "dev:{");
+  json_printf(&dev, "name:%Q", mgos_sys_config_get_device_id());
+  json_printf(&dev, ",ids:[%Q]", ha->node_name);
+  json_printf(&dev, ",cns:[[mac,%Q]]", mgos_sys_ro_vars_get_mac_address());
+  json_printf(&dev, ",mdl:%Q", mgos_sys_ro_vars_get_app());
+  json_printf(&dev, ",sw:\"%s (%s)\"", mgos_sys_ro_vars_get_fw_version(), mgos_sys_ro_vars_get_fw_id());
+  json_printf(&dev, ",mf:%Q", "Mongoose OS");
+  json_printf(&dev, "}");
+  mbuf_append(&mbuf_dev, "\0", 1);
+  mbuf_trim(&mbuf_dev);
+
+  ha->device_config = mbuf_dev.buf;
+  return ha->device_config;
+}
+
+// Renders the discovery config of the object (c == NULL) or class into its
+// cache, unless it is still valid there.
+static bool mgos_homeassistant_config_render(struct mgos_homeassistant *ha, struct mgos_homeassistant_object *o,
+                                             struct mgos_homeassistant_object_class *c) {
+  struct mgos_homeassistant_config_cache *cc = c ? &c->config : &o->config;
+  struct ha_component_data *hcd = ha_component_data(c ? c->component : o->component);
+  struct mbuf mbuf_friendlyname;
+  struct json_out payload = JSON_OUT_MBUF(&cc->payload);
+  const char *dev;
+
+  if (cc->payload.len > 0) return true;
+  if (!(dev = mgos_homeassistant_device_config(ha))) return false;
+
+  mbuf_init(&mbuf_friendlyname, 50);
+  gen_friendlyname(&mbuf_friendlyname, o, c);
+
+  json_printf(&payload, "{\"~\":%Q,name:%.*Q", o->topics.prefix, (int) mbuf_friendlyname.len, mbuf_friendlyname.buf);
+  json_printf(&payload, ",uniq_id:\"%s:%.*s\"", mgos_sys_ro_vars_get_mac_address(), (int) mbuf_friendlyname.len, mbuf_friendlyname.buf);
+  json_printf(&payload, ",avty_t:\"%s\"", mgos_sys_config_get_device_id());
+
+  if (hcd->json_config_additional_payload) json_printf(&payload, ",%s", hcd->json_config_additional_payload);
+  if (!hcd->no_stat_t) json_printf(&payload, ",stat_t:%Q", o->aggregated ? mgos_homeassistant_aggregate_topic(ha) : "~");
+  if (mgos_homeassistant_object_get_cmd(o, NULL) && !hcd->no_cmd_t) json_printf(&payload, ",cmd_t:%Q", "~/cmd");
+  if (mgos_homeassistant_object_get_attr(o, NULL)) json_printf(&payload, ",json_attr_t:%Q", "~/attr");
+  if (c && !hcd->no_dev_cla) json_printf(&payload, ",dev_cla:%Q", c->class_name);
+  if (o->aggregated) {
+    if (c && !hcd->no_val_tpl) json_printf(&payload, ",val_tpl:\"{{%s['%s'].%s}}\"", "value_json", o->object_name, c->class_name);
+    if (c && c->json_config_additional_payload) mgos_homeassistant_aggregate_payload(&cc->payload, c->json_config_additional_payload, o->object_name);
+    if (o->json_config_additional_payload) mgos_homeassistant_aggregate_payload(&cc->payload, o->json_config_additional_payload, o->object_name);
+  } else {
+    if (c && !hcd->no_val_tpl) json_printf(&payload, ",val_tpl:\"{{%s%s}}\"", "value_json.", c->class_name);
+    if (c && c->json_config_additional_payload) json_printf(&payload, ",%s", c->json_config_additional_payload);
+    if (o->json_config_additional_payload) json_printf(&payload, ",%s", o->json_config_additional_payload);
+  }
+  json_printf(&payload, ",%s", dev);
+  json_printf(&payload, "}");
+  mbuf_trim(&cc->payload);
+  mbuf_free(&mbuf_friendlyname);
+
+  cc->hash = content_hash(cc->payload.buf, cc->payload.len);
+  LOG(LL_DEBUG, ("Rendered config for '%s%s%s', hash %08x%s", o->object_name, c ? "_" : "", c ? c->class_name : "", (unsigned) cc->hash,
+                 (cc->sent && cc->sent_hash == cc->hash) ? " (unchanged)" : ""));
+  return true;
+}
+
+// Drops the rendered discovery configs of the object and its classes, so they
+// are rendered again upon their next use.
+static void mgos_homeassistant_object_invalidate_config(struct mgos_homeassistant_object *o) {
+  struct mgos_homeassistant_object_class *c;
+
+  mbuf_free(&o->config.payload);
+  SLIST_FOREACH(c, &o->classes, entry) {
+    mbuf_free(&c->config.payload);
+  }
+}
+
+uint32_t mgos_homeassistant_config_hash(struct mgos_homeassistant *ha) {
+  struct mgos_homeassistant_object *o;
+  struct mgos_homeassistant_object_class *c;
+  uint32_t h = 2166136261u;
+  if (!ha) return 0;
+
+  SLIST_FOREACH(o, &ha->objects, entry) {
+    if (mgos_homeassistant_config_render(ha, o, NULL)) h = (h ^ o->config.hash) * 16777619u;
+    SLIST_FOREACH(c, &o->classes, entry) {
+      if (mgos_homeassistant_config_render(ha, o, c)) h = (h ^ c->config.hash) * 16777619u;
+    }
+  }
+  return h;
+}
+
 bool mgos_homeassistant_send_config(struct mgos_homeassistant *ha, bool force) {
   struct mgos_homeassistant_object *o;
   if (!ha) return false;
@@ -292,7 +820,14 @@ bool mgos_homeassistant_send_config(struct mgos_homeassistant *ha, bool force) {
 
   SLIST_FOREACH(o, &ha->objects, entry) {
     done++;
-    if (force) o->config_sent = false;
+    if (force) {
+      struct mgos_homeassistant_object_class *c;
+      o->config_sent = false;
+      o->config.sent = false;
+      SLIST_FOREACH(c, &o->classes, entry) {
+        c->config.sent = false;
+      }
+    }
     if (mgos_homeassistant_object_send_config(o)) success++;
   }
   LOG((done == success) ? LL_DEBUG : LL_WARN, ("Sent %u configs (%u successfully) for node '%s'", done, success, ha->node_name));
@@ -303,11 +838,311 @@ bool mgos_homeassistant_send_status(struct mgos_homeassistant *ha) {
   struct mgos_homeassistant_object *o;
   if (!ha) return false;
   SLIST_FOREACH(o, &ha->objects, entry) {
-    mgos_homeassistant_object_send_status(o);
+    mgos_homeassistant_object_refresh_status(o);
+  }
+  return true;
+}
+
+struct mgos_homeassistant_offline_rec {
+  struct mgos_homeassistant_object *o;  // NULL once overwritten, or when the object is removed
+  double ts;                            // wall time at which the status was rendered
+  uint16_t size;                        // record size including header and padding, 0 marks a wrap
+  uint16_t len;                         // status length
+};
+
+#define OFFLINE_HDR ARENA_ROUND(sizeof(struct mgos_homeassistant_offline_rec))
+
+// Returns the record at *off, moving *off to the start of the buffer if the
+// records wrapped there.
+static struct mgos_homeassistant_offline_rec *mgos_homeassistant_offline_rec(struct mgos_homeassistant_offline *q, size_t *off) {
+  if (q->size - *off < OFFLINE_HDR || ((struct mgos_homeassistant_offline_rec *) (q->buf + *off))->size == 0) *off = 0;
+  return (struct mgos_homeassistant_offline_rec *) (q->buf + *off);
+}
+
+// Removes the oldest record. Caller ensures there is one.
+static void mgos_homeassistant_offline_pop(struct mgos_homeassistant_offline *q) {
+  struct mgos_homeassistant_offline_rec *rec = mgos_homeassistant_offline_rec(q, &q->tail);
+
+  q->tail += rec->size;
+  q->records--;
+  if (rec->o) {
+    rec->o->offline_queued--;
+    q->queued--;
+  }
+  if (q->records == 0) q->head = q->tail = 0;
+}
+
+// Forgets the queued statuses of the object, or only its oldest one.
+static void mgos_homeassistant_offline_forget(struct mgos_homeassistant_object *o, bool oldest) {
+  struct mgos_homeassistant_offline *q = &o->ha->offline;
+  size_t off = q->tail;
+
+  for (uint32_t i = 0; i < q->records && o->offline_queued > 0; i++) {
+    struct mgos_homeassistant_offline_rec *rec = mgos_homeassistant_offline_rec(q, &off);
+    off += rec->size;
+    if (rec->o != o) continue;
+    rec->o = NULL;
+    o->offline_queued--;
+    q->queued--;
+    if (oldest) {
+      q->overwritten++;
+      return;
+    }
+  }
+}
+
+// Keeps the status of the object for replay after reconnecting. With
+// homeassistant.offline.samples at 1 only the latest status of each object is
+// kept, otherwise up to that many. The oldest records make room for new ones.
+static void mgos_homeassistant_offline_push(struct mgos_homeassistant_object *o) {
+  struct mgos_homeassistant_offline *q = &o->ha->offline;
+  struct mgos_homeassistant_offline_rec *rec;
+  int samples = mgos_sys_config_get_homeassistant_offline_samples();
+  size_t need = ARENA_ROUND(OFFLINE_HDR + o->status.len);
+
+  if (!q->buf) {
+    size_t size = (size_t) mgos_sys_config_get_homeassistant_offline_bytes() & ~((size_t) ARENA_ALIGN - 1);
+    if (size < OFFLINE_HDR) return;
+    if (!(q->buf = malloc(size))) return;
+    q->size = size;
+  }
+  if (need > q->size || need > UINT16_MAX) {
+    q->dropped++;
+    return;
+  }
+  if (o->offline_queued >= (samples < 1 ? 1 : samples)) mgos_homeassistant_offline_forget(o, true);
+
+  for (;;) {
+    if (q->records == 0 || q->head > q->tail) {
+      // Free space is at the end of the buffer, and before the tail.
+      if (q->size - q->head >= need) break;
+      if (q->size - q->head >= OFFLINE_HDR) ((struct mgos_homeassistant_offline_rec *) (q->buf + q->head))->size = 0;
+      q->head = 0;
+      continue;
+    }
+    // Free space is between head and tail.
+    if (q->tail - q->head >= need) break;
+    if (mgos_homeassistant_offline_rec(q, &q->tail)->o) q->dropped++;
+    mgos_homeassistant_offline_pop(q);
+  }
+
+  rec = (struct mgos_homeassistant_offline_rec *) (q->buf + q->head);
+  rec->o = o;
+  rec->ts = mg_time();
+  rec->size = need;
+  rec->len = o->status.len;
+  memcpy((char *) rec + OFFLINE_HDR, o->status.buf, o->status.len);
+  q->head += need;
+  q->records++;
+  q->queued++;
+  o->offline_queued++;
+}
+
+// Publishes a status JSON object with the time it was taken added as 'ts'.
+static void mgos_homeassistant_pub_stamped(struct mgos_homeassistant *ha, const char *topic, double ts, const char *payload, size_t len) {
+  struct mbuf m;
+  char buf[32];
+  int buf_len;
+
+  if (len < 2 || payload[0] != '{') {
+    mgos_homeassistant_pub(ha, topic, payload, len, false);
+    return;
+  }
+  buf_len = snprintf(buf, sizeof(buf), "{\"ts\":%.0f%s", ts, len > 2 ? "," : "");
+  mbuf_init(&m, buf_len + len);
+  mbuf_append(&m, buf, buf_len);
+  mbuf_append(&m, payload + 1, len - 1);
+  mgos_homeassistant_pub(ha, topic, m.buf, m.len, false);
+  mbuf_free(&m);
+}
+
+// Publishes the oldest kept status, if it was not overwritten, and removes it.
+// Statuses are stamped with the time they were rendered, unless only the
+// latest status of each object is kept.
+static void mgos_homeassistant_offline_replay(struct mgos_homeassistant *ha) {
+  struct mgos_homeassistant_offline *q = &ha->offline;
+  struct mgos_homeassistant_offline_rec *rec = mgos_homeassistant_offline_rec(q, &q->tail);
+  const char *payload = (const char *) rec + OFFLINE_HDR;
+
+  if (rec->o) {
+    if (mgos_sys_config_get_homeassistant_offline_samples() > 1)
+      mgos_homeassistant_pub_stamped(ha, rec->o->topics.prefix, rec->ts, payload, rec->len);
+    else
+      mgos_homeassistant_pub(ha, rec->o->topics.prefix, payload, rec->len, false);
+    q->replayed++;
+  }
+  mgos_homeassistant_offline_pop(q);
+}
+
+static void mgos_homeassistant_journal_replay_cb(const char *name, uint32_t ts, const char *payload, size_t len, void *user_data) {
+  struct mgos_homeassistant *ha = (struct mgos_homeassistant *) user_data;
+  struct mgos_homeassistant_object *o = mgos_homeassistant_object_get_exact(ha, name);
+
+  if (!o || o->aggregated) {
+    LOG(LL_DEBUG, ("Journal holds a status for unknown object '%s', skipping", name));
+    return;
+  }
+  mgos_homeassistant_pub_stamped(ha, o->topics.prefix, ts, payload, len);
+}
+
+// Keeps the status of the object while disconnected: sensor statuses go to the
+// journal if there is one, and all others, or those the journal cannot take,
+// to the offline buffer.
+static void mgos_homeassistant_object_keep_status(struct mgos_homeassistant_object *o) {
+  if (o->ha->journal && o->component == COMPONENT_SENSOR &&
+      journal_append(o->ha->journal, o->object_name, mg_time(), o->status.buf, o->status.len))
+    return;
+  mgos_homeassistant_offline_push(o);
+}
+
+static void mgos_homeassistant_announce_stop(struct mgos_homeassistant *ha) {
+  mgos_clear_timer(ha->announce.timer);
+  ha->announce.timer = MGOS_INVALID_TIMER_ID;
+  ha->announce.next = NULL;
+}
+
+static void mgos_homeassistant_announce_timer_cb(void *ud) {
+  struct mgos_homeassistant *ha = (struct mgos_homeassistant *) ud;
+  struct mgos_homeassistant_announce *an;
+  uint32_t msgs, bytes;
+  if (!ha) return;
+
+  an = &ha->announce;
+  if (!mgos_mqtt_global_is_connected()) {
+    // The next CONNACK starts over.
+    LOG(LL_DEBUG, ("MQTT not connected, abandoning announcement for node '%s'", ha->node_name));
+    mgos_homeassistant_announce_stop(ha);
+    return;
+  }
+
+  an->ticks++;
+  msgs = ha->pub_msgs;
+  bytes = ha->pub_bytes;
+  for (;;) {
+    struct mgos_homeassistant_object *o;
+    bool replay;
+
+    // Statuses kept while disconnected are replayed between configs and
+    // statuses: the journal first, as the offline buffer only takes sensor
+    // statuses once the journal is full.
+    if (!an->next && !an->status_phase && journal_pending(ha->journal) == 0 && ha->offline.records == 0) {
+      an->status_phase = true;
+      an->next = SLIST_FIRST(&ha->objects);
+    }
+    replay = !an->next && !an->status_phase;
+    if (!an->next && !replay) break;
+    if ((int) (ha->pub_msgs - msgs) >= mgos_sys_config_get_homeassistant_announce_msgs_per_tick()) break;
+    if ((int) (ha->pub_bytes - bytes) >= mgos_sys_config_get_homeassistant_announce_bytes_per_tick()) break;
+    if ((int) mgos_mqtt_num_unsent_bytes() > mgos_sys_config_get_homeassistant_announce_max_unsent()) {
+      an->stalls++;
+      break;
+    }
+
+    if (replay && journal_pending(ha->journal) > 0) {
+      int max = mgos_sys_config_get_homeassistant_announce_msgs_per_tick() - (int) (ha->pub_msgs - msgs);
+      if (journal_replay(ha->journal, max, mgos_homeassistant_journal_replay_cb, ha) <= 0) break;
+      continue;
+    }
+    if (replay) {
+      mgos_homeassistant_offline_replay(ha);
+      continue;
+    }
+
+    // Advance first, pre_remove_cb() or automations may remove this object.
+    o = an->next;
+    an->next = SLIST_NEXT(o, entry);
+    if (an->status_phase)
+      mgos_homeassistant_object_refresh_status(o);
+    else
+      mgos_homeassistant_object_send_config(o);
+  }
+  an->msgs += ha->pub_msgs - msgs;
+  an->bytes += ha->pub_bytes - bytes;
+
+  if (an->next || !an->status_phase) return;
+  mgos_homeassistant_announce_stop(ha);
+  an->duration = mgos_uptime() - an->started;
+  an->completed++;
+  LOG(LL_INFO, ("Announced node '%s' in %.3f seconds: %u messages, %u bytes, %u ticks, %u stalls", ha->node_name, an->duration,
+                (unsigned) an->msgs, (unsigned) an->bytes, (unsigned) an->ticks, (unsigned) an->stalls));
+}
+
+bool mgos_homeassistant_announce(struct mgos_homeassistant *ha) {
+  struct mgos_homeassistant_object *o;
+  struct mgos_homeassistant_object_class *c;
+  struct mgos_homeassistant_announce *an;
+  if (!ha) return false;
+
+  if (mgos_sys_config_get_homeassistant_announce_msgs_per_tick() <= 0) {
+    mgos_homeassistant_send_config(ha, true);
+    while (journal_replay(ha->journal, 16, mgos_homeassistant_journal_replay_cb, ha) > 0) continue;
+    while (ha->offline.records > 0) mgos_homeassistant_offline_replay(ha);
+    return mgos_homeassistant_send_status(ha);
+  }
+
+  // Force all configs to be resent, as mgos_homeassistant_send_config(ha, true) would.
+  SLIST_FOREACH(o, &ha->objects, entry) {
+    o->config_sent = false;
+    o->config.sent = false;
+    SLIST_FOREACH(c, &o->classes, entry) {
+      c->config.sent = false;
+    }
   }
+
+  an = &ha->announce;
+  mgos_homeassistant_announce_stop(ha);
+  an->next = SLIST_FIRST(&ha->objects);
+  an->status_phase = false;
+  an->started = mgos_uptime();
+  an->ticks = an->stalls = an->msgs = an->bytes = 0;
+  an->timer = mgos_set_timer(mgos_sys_config_get_homeassistant_announce_interval_ms(), MGOS_TIMER_REPEAT, mgos_homeassistant_announce_timer_cb, ha);
+  LOG(LL_DEBUG, ("Announcing node '%s'", ha->node_name));
+  mgos_homeassistant_announce_timer_cb(ha);
   return true;
 }
 
+bool mgos_homeassistant_update_topics(struct mgos_homeassistant *ha) {
+  struct mgos_homeassistant_object *o;
+  struct mgos_homeassistant_object_class *c;
+  bool ret = true;
+  if (!ha) return false;
+
+  LOG(LL_DEBUG, ("Updating topics for node '%s'", ha->node_name));
+  if (ha->discovery_prefix) free(ha->discovery_prefix);
+  ha->discovery_prefix = strdup(mgos_sys_config_get_homeassistant_discovery_prefix());
+  if (ha->device_config) free(ha->device_config);
+  ha->device_config = NULL;
+  if (ha->aggregate.topic) free(ha->aggregate.topic);
+  ha->aggregate.topic = NULL;
+
+  SLIST_FOREACH(o, &ha->objects, entry) {
+    struct mgos_homeassistant_object_topics t;
+    if (!mgos_homeassistant_object_build_topics(o, &t)) {
+      ret = false;
+      continue;
+    }
+    if (!mgos_sys_config_get_homeassistant_node_subscription() && 0 != strcmp(t.sub, o->topics.sub)) {
+      if (mgos_mqtt_global_is_connected()) mgos_mqtt_unsub(o->topics.sub);
+      mgos_mqtt_sub(t.sub, mgos_homeassistant_mqtt_cb, o);
+    }
+    free(o->topics.buf);
+    o->topics = t;
+    mgos_homeassistant_object_invalidate_config(o);
+
+    SLIST_FOREACH(c, &o->classes, entry) {
+      if (!mgos_homeassistant_object_class_build_topics(c)) ret = false;
+    }
+  }
+  if (mgos_sys_config_get_homeassistant_node_subscription() && !SLIST_EMPTY(&ha->objects)) mgos_homeassistant_node_subscribe(ha);
+  return ret;
+}
+
+// Rebuilds the cached config topics if homeassistant.discovery_prefix has changed since they were built.
+static void mgos_homeassistant_check_discovery_prefix(struct mgos_homeassistant *ha) {
+  if (ha->discovery_prefix && 0 == strcmp(ha->discovery_prefix, mgos_sys_config_get_homeassistant_discovery_prefix())) return;
+  mgos_homeassistant_update_topics(ha);
+}
+
 bool mgos_homeassistant_clear(struct mgos_homeassistant *ha) {
   if (!ha) return false;
 
@@ -323,49 +1158,102 @@ bool mgos_homeassistant_clear(struct mgos_homeassistant *ha) {
   return true;
 }
 
-struct mgos_homeassistant_object *mgos_homeassistant_object_add(struct mgos_homeassistant *ha, const char *object_name,
-                                                                enum mgos_homeassistant_component ha_component,
-                                                                const char *json_config_additional_payload, ha_status_cb status_cb, void *user_data) {
-  struct mgos_homeassistant_object *o = calloc(1, sizeof(*o));
+static struct mgos_homeassistant_object *mgos_homeassistant_object_create(struct mgos_homeassistant *ha, const char *object_name,
+                                                                         enum mgos_homeassistant_component ha_component,
+                                                                         const char *json_config_additional_payload, bool payload_static,
+                                                                         ha_status_cb status_cb, void *user_data) {
+  struct mgos_homeassistant_object *o;
 
-  if (!o || !ha || !object_name) return NULL;
+  if (!ha || !object_name) return NULL;
   if (!mgos_homeassistant_isvalid_name(object_name)) {
     LOG(LL_ERROR, ("Invalid object name '%s'", object_name));
-    free(o);
     return NULL;
   }
   if (mgos_homeassistant_exists_objectname(ha, object_name)) {
     LOG(LL_ERROR, ("Object name '%s' already exists in node '%s'", object_name, ha->node_name));
-    free(o);
     return NULL;
   }
+  if (!(o = mgos_homeassistant_alloc(ha, sizeof(*o)))) return NULL;
 
   o->ha = ha;
   o->component = ha_component;
-  o->object_name = strdup(object_name);
-  if (json_config_additional_payload) o->json_config_additional_payload = strdup(json_config_additional_payload);
+  if (!(o->object_name = mgos_homeassistant_name_intern(ha, object_name))) {
+    mgos_homeassistant_free(ha, o, sizeof(*o));
+    return NULL;
+  }
+  o->payload_static = payload_static;
+  if (json_config_additional_payload)
+    o->json_config_additional_payload =
+        payload_static ? (char *) json_config_additional_payload : mgos_homeassistant_strdup(ha, json_config_additional_payload);
   o->user_data = user_data;
   o->status_cb = status_cb;
+  o->aggregated = mgos_homeassistant_aggregate_match(o);
+  if (!mgos_homeassistant_object_build_topics(o, &o->topics)) {
+    LOG(LL_ERROR, ("Could not build topics for object '%s'", object_name));
+    mgos_homeassistant_payload_free(ha, o->json_config_additional_payload, o->payload_static);
+    mgos_homeassistant_name_release(ha, o->object_name);
+    mgos_homeassistant_free(ha, o, sizeof(*o));
+    return NULL;
+  }
   mbuf_init(&o->status, 20);
+  mbuf_init(&o->config.payload, 0);
   SLIST_INIT(&o->classes);
   SLIST_INIT(&o->cmds);
   SLIST_INIT(&o->attrs);
   SLIST_INSERT_HEAD(&ha->objects, o, entry);
+  mgos_homeassistant_object_index_add(ha, o);
 
-  // Add a wildcard MQTT subscription for this object.
-  struct mbuf mbuf_topic;
-  mbuf_init(&mbuf_topic, 100);
-  gen_topicprefix(&mbuf_topic, o);
-  mbuf_append(&mbuf_topic, "/#", 2);
-  mbuf_append_nul(&mbuf_topic);
-  mgos_mqtt_sub(mbuf_topic.buf, mgos_homeassistant_mqtt_cb, o);
-  mbuf_free(&mbuf_topic);
+  if (mgos_sys_config_get_homeassistant_node_subscription()) {
+    mgos_homeassistant_node_subscribe(ha);
+  } else {
+    // Add a wildcard MQTT subscription for this object.
+    mgos_mqtt_sub(o->topics.sub, mgos_homeassistant_mqtt_cb, o);
+  }
 
   mgos_homeassistant_call_handlers(ha, MGOS_HOMEASSISTANT_EV_OBJECT_ADD, o);
   LOG(LL_DEBUG, ("Created object '%s' on node '%s'", o->object_name, o->ha->node_name));
   return o;
 }
 
+struct mgos_homeassistant_object *mgos_homeassistant_object_add(struct mgos_homeassistant *ha, const char *object_name,
+                                                                enum mgos_homeassistant_component ha_component,
+                                                                const char *json_config_additional_payload, ha_status_cb status_cb, void *user_data) {
+  return mgos_homeassistant_object_create(ha, object_name, ha_component, json_config_additional_payload, false, status_cb, user_data);
+}
+
+struct mgos_homeassistant_object *mgos_homeassistant_object_add_static(struct mgos_homeassistant *ha, const char *object_name,
+                                                                       enum mgos_homeassistant_component ha_component,
+                                                                       const char *json_config_additional_payload, ha_status_cb status_cb,
+                                                                       void *user_data) {
+  return mgos_homeassistant_object_create(ha, object_name, ha_component, json_config_additional_payload, true, status_cb, user_data);
+}
+
+static bool mgos_homeassistant_object_call_cmd(struct mgos_homeassistant_object_cmd *c, const char *payload, const int payload_len) {
+  const char *name = c->cmd_name ? c->cmd_name : "(default)";
+  if (!c->cmd_cb) {
+    LOG(LL_WARN, ("No callback function on command '%s' of object '%s'", name, c->object->object_name));
+    return false;
+  }
+  LOG(LL_DEBUG, ("Calling command '%s' of object '%s'", name, c->object->object_name));
+  c->object->stats.cmds++;
+  c->cmd_cb(c->object, payload, payload_len);
+  mgos_homeassistant_call_handlers(c->object->ha, MGOS_HOMEASSISTANT_EV_OBJECT_CMD, c);
+  return true;
+}
+
+static bool mgos_homeassistant_object_call_attr(struct mgos_homeassistant_object_attr *a, const char *payload, const int payload_len) {
+  const char *name = a->attr_name ? a->attr_name : "(default)";
+  if (!a->attr_cb) {
+    LOG(LL_WARN, ("No callback function on attribute '%s' of object '%s'", name, a->object->object_name));
+    return false;
+  }
+  LOG(LL_DEBUG, ("Calling attribute '%s' of object '%s'", name, a->object->object_name));
+  a->object->stats.cmds++;
+  a->attr_cb(a->object, payload, payload_len);
+  mgos_homeassistant_call_handlers(a->object->ha, MGOS_HOMEASSISTANT_EV_OBJECT_ATTR, a);
+  return true;
+}
+
 bool mgos_homeassistant_object_cmd(struct mgos_homeassistant_object *o, const char *name, const char *payload, const int payload_len) {
   struct mgos_homeassistant_object_cmd *c;
   if (!o) return false;
@@ -373,14 +1261,7 @@ bool mgos_homeassistant_object_cmd(struct mgos_homeassistant_object *o, const ch
     LOG(LL_WARN, ("No command '%s' on object '%s'", name ? name : "(default)", o->object_name));
     return false;
   }
-  if (!c->cmd_cb) {
-    LOG(LL_WARN, ("No callback function on command '%s' of object '%s'", name ? name : "(default)", o->object_name));
-    return false;
-  }
-  LOG(LL_DEBUG, ("Calling command '%s' of object '%s'", name ? name : "(default)", o->object_name));
-  c->cmd_cb(o, payload, payload_len);
-  mgos_homeassistant_call_handlers(o->ha, MGOS_HOMEASSISTANT_EV_OBJECT_CMD, c);
-  return true;
+  return mgos_homeassistant_object_call_cmd(c, payload, payload_len);
 }
 
 bool mgos_homeassistant_object_attr(struct mgos_homeassistant_object *o, const char *name, const char *payload, const int payload_len) {
@@ -390,22 +1271,14 @@ bool mgos_homeassistant_object_attr(struct mgos_homeassistant_object *o, const c
     LOG(LL_WARN, ("No attribute '%s' on object '%s'", name ? name : "(default)", o->object_name));
     return false;
   }
-  if (!a->attr_cb) {
-    LOG(LL_WARN, ("No callback function on attribute '%s' of object '%s'", name ? name : "(default)", o->object_name));
-    return false;
-  }
-  LOG(LL_DEBUG, ("Calling attribute '%s' of object '%s'", name ? name : "(default)", o->object_name));
-  a->attr_cb(o, payload, payload_len);
-  mgos_homeassistant_call_handlers(o->ha, MGOS_HOMEASSISTANT_EV_OBJECT_ATTR, a);
-  return true;
+  return mgos_homeassistant_object_call_attr(a, payload, payload_len);
 }
 
 bool mgos_homeassistant_object_remove_cmd(struct mgos_homeassistant_object_cmd **c) {
   if (!(*c)) return false;
 
   LOG(LL_DEBUG, ("Removing command '%s' from object '%s'", (*c)->cmd_name ? (*c)->cmd_name : "(default)", (*c)->object->object_name));
-  if ((*c)->cmd_name) free((*c)->cmd_name);
-  free(*c);
+  mgos_homeassistant_free((*c)->object->ha, *c, sizeof(**c) + ((*c)->cmd_name ? (*c)->cmd_len + 1 : 0));
   *c = NULL;
   return true;
 }
@@ -414,8 +1287,7 @@ bool mgos_homeassistant_object_remove_attr(struct mgos_homeassistant_object_attr
   if (!(*a)) return false;
 
   LOG(LL_DEBUG, ("Removing attribute '%s' from object '%s'", (*a)->attr_name ? (*a)->attr_name : "(default)", (*a)->object->object_name));
-  if ((*a)->attr_name) free((*a)->attr_name);
-  free(*a);
+  mgos_homeassistant_free((*a)->object->ha, *a, sizeof(**a) + ((*a)->attr_name ? (*a)->attr_len + 1 : 0));
   *a = NULL;
   return true;
 }
@@ -425,15 +1297,23 @@ bool mgos_homeassistant_object_add_cmd_cb(struct mgos_homeassistant_object *o, c
   if (!o) return false;
 
   if (!(c = mgos_homeassistant_object_get_cmd(o, name))) {
-    if (!(c = calloc(1, sizeof(*c)))) return false;
+    size_t len = name ? strlen(name) : 0;
+    // The name is stored in the same allocation, after the struct.
+    if (!(c = mgos_homeassistant_alloc(o->ha, sizeof(*c) + (name ? len + 1 : 0)))) return false;
     LOG(LL_DEBUG, ("Creating command '%s' on object '%s'", name ? name : "(default)", o->object_name));
-    if (name) c->cmd_name = strdup(name);
+    if (name) {
+      c->cmd_name = (char *) (c + 1);
+      memcpy(c->cmd_name, name, len + 1);
+      c->cmd_hash = name_hash(name, len);
+      c->cmd_len = len;
+    }
     SLIST_INSERT_HEAD(&o->cmds, c, entry);
   } else {
     LOG(LL_DEBUG, ("Replacing command '%s' on object '%s'", name ? name : "(default)", o->object_name));
   }
   c->cmd_cb = cmd_cb;
   c->object = o;
+  if (!name) mgos_homeassistant_object_invalidate_config(o);
   return true;
 }
 
@@ -442,28 +1322,63 @@ bool mgos_homeassistant_object_add_attr_cb(struct mgos_homeassistant_object *o,
   if (!o) return false;
 
   if (!(a = mgos_homeassistant_object_get_attr(o, name))) {
-    if (!(a = calloc(1, sizeof(*a)))) return false;
+    size_t len = name ? strlen(name) : 0;
+    // The name is stored in the same allocation, after the struct.
+    if (!(a = mgos_homeassistant_alloc(o->ha, sizeof(*a) + (name ? len + 1 : 0)))) return false;
     LOG(LL_DEBUG, ("Creating attribute '%s' on object '%s'", name ? name : "(default)", o->object_name));
-    if (name) a->attr_name = strdup(name);
+    if (name) {
+      a->attr_name = (char *) (a + 1);
+      memcpy(a->attr_name, name, len + 1);
+      a->attr_hash = name_hash(name, len);
+      a->attr_len = len;
+    }
     SLIST_INSERT_HEAD(&o->attrs, a, entry);
   } else {
     LOG(LL_DEBUG, ("Replacing attribute '%s' on object '%s'", name ? name : "(default)", o->object_name));
   }
   a->attr_cb = attr_cb;
   a->object = o;
+  if (!name) mgos_homeassistant_object_invalidate_config(o);
   return true;
 }
 
 struct mgos_homeassistant_object *mgos_homeassistant_object_get(struct mgos_homeassistant *ha, const char *suffix) {
   struct mgos_homeassistant_object *o = NULL;
+  size_t suffix_len;
   if (!ha || !suffix) return NULL;
 
-  SLIST_FOREACH(o, &ha->objects, entry) {
+  suffix_len = strlen(suffix);
+  if (suffix_len < MGOS_HOMEASSISTANT_SUFFIX_LEN) {
+    SLIST_FOREACH(o, &ha->objects, entry) {
+      if (endswith(o->object_name, strlen(o->object_name), suffix)) return o;
+    }
+    return NULL;
+  }
+
+  // Both lists insert at head, so the bucket yields matches in the same order as ha->objects.
+  SLIST_FOREACH(o, &ha->suffix_index[suffix_hash(suffix, suffix_len) % MGOS_HOMEASSISTANT_INDEX_SIZE], suffix_entry) {
     if (endswith(o->object_name, strlen(o->object_name), suffix)) return o;
   }
   return NULL;
 }
 
+struct mgos_homeassistant_object *mgos_homeassistant_object_get_exact(struct mgos_homeassistant *ha, const char *name) {
+  if (!ha || !name) return NULL;
+  return mgos_homeassistant_object_get_exact_n(ha, name, strlen(name));
+}
+
+// Accounts one status callback call that took us microseconds.
+static void mgos_homeassistant_stats_cb_time(struct mgos_homeassistant_stats *st, int64_t us) {
+  int64_t limit = 100;
+  int i;
+
+  if (us < 0) us = 0;
+  for (i = 0; i < MGOS_HOMEASSISTANT_CB_HIST_BUCKETS - 1 && us >= limit; i++) limit *= 10;
+  st->cb_hist[i]++;
+  st->cb_us_total += us;
+  if (us > st->cb_us_max) st->cb_us_max = us;
+}
+
 bool mgos_homeassistant_object_get_status(struct mgos_homeassistant_object *o) {
   struct mgos_homeassistant_object_class *c = NULL;
   int i;
@@ -473,9 +1388,14 @@ bool mgos_homeassistant_object_get_status(struct mgos_homeassistant_object *o) {
   struct json_out payload = JSON_OUT_MBUF(&o->status);
   o->status.len = 0;
 
+  o->stats.renders++;
   json_printf(&payload, "{");
   len = o->status.len;
-  if (o->status_cb) o->status_cb(o, &payload);
+  if (o->status_cb) {
+    int64_t start = mgos_uptime_micros();
+    o->status_cb(o, &payload);
+    mgos_homeassistant_stats_cb_time(&o->stats, mgos_uptime_micros() - start);
+  }
 
   i = 0;
   SLIST_FOREACH(c, &o->classes, entry) {
@@ -487,8 +1407,11 @@ bool mgos_homeassistant_object_get_status(struct mgos_homeassistant_object *o) {
     if (!c->status_cb) {
       json_printf(&payload, "%Q", NULL);
     } else {
+      int64_t start = mgos_uptime_micros();
       len = o->status.len;
       c->status_cb(o, &payload);
+      mgos_homeassistant_stats_cb_time(&c->stats, mgos_uptime_micros() - start);
+      c->stats.renders++;
       if (o->status.len == len) json_printf(&payload, "%Q", NULL);
     }
     i++;
@@ -497,108 +1420,185 @@ bool mgos_homeassistant_object_get_status(struct mgos_homeassistant_object *o) {
   return true;
 }
 
-bool mgos_homeassistant_object_send_status(struct mgos_homeassistant_object *o) {
-  struct mbuf mbuf_topic;
+static void mgos_homeassistant_object_clear_dirty(struct mgos_homeassistant_object *o) {
+  if (!o->status_dirty) return;
+  STAILQ_REMOVE(&o->ha->dirty, o, mgos_homeassistant_object, dirty_entry);
+  o->status_dirty = false;
+}
 
+// Renders the aggregated status from the objects' last statuses and publishes
+// it. Unless forced, an unchanged aggregated status is suppressed like object
+// statuses are, see mgos_homeassistant_object_publish_status().
+static void mgos_homeassistant_aggregate_send(struct mgos_homeassistant *ha) {
+  struct mgos_homeassistant_aggregate *ag = &ha->aggregate;
+  struct mgos_homeassistant_object *o;
+  struct json_out out = JSON_OUT_MBUF(&ag->payload);
+  int max_silence = mgos_sys_config_get_homeassistant_status_max_silence();
+  double now = mgos_uptime();
+  uint32_t hash;
+  bool first = true;
+
+  ag->pending = false;
+  ag->payload.len = 0;
+  json_printf(&out, "{");
+  SLIST_FOREACH(o, &ha->objects, entry) {
+    if (!o->aggregated) continue;
+    if (o->status.len == 0) mgos_homeassistant_object_get_status(o);
+    json_printf(&out, "%s%Q:", first ? "" : ",", o->object_name);
+    mbuf_append(&ag->payload, o->status.buf, o->status.len);
+    first = false;
+  }
+  json_printf(&out, "}");
+
+  LOG(LL_DEBUG, ("Aggregated status topic='%s' payload='%.*s'", mgos_homeassistant_aggregate_topic(ha), (int) ag->payload.len, ag->payload.buf));
+  // Not kept for replay: the announcement upon reconnect sends the current one.
+  if (!mgos_mqtt_global_is_connected()) {
+    LOG(LL_DEBUG, ("MQTT not connected, skipping aggregated status for node '%s'", ha->node_name));
+    return;
+  }
+  hash = content_hash(ag->payload.buf, ag->payload.len);
+  if (!ag->force && max_silence > 0 && ag->sent_at > 0 && hash == ag->hash && now - ag->sent_at < max_silence) {
+    LOG(LL_DEBUG, ("Aggregated status unchanged, skipping status for node '%s'", ha->node_name));
+  } else {
+    mgos_homeassistant_pub(ha, mgos_homeassistant_aggregate_topic(ha), ag->payload.buf, ag->payload.len, false);
+    ag->hash = hash;
+    ag->sent_at = now;
+  }
+  ag->force = false;
+}
+
+static void mgos_homeassistant_dirty_timer_cb(void *ud) {
+  struct mgos_homeassistant *ha = (struct mgos_homeassistant *) ud;
+  if (!ha) return;
+  ha->dirty_timer = MGOS_INVALID_TIMER_ID;
+  mgos_homeassistant_flush_status(ha);
+}
+
+bool mgos_homeassistant_flush_status(struct mgos_homeassistant *ha) {
+  struct mgos_homeassistant_object *o;
+  int todo = 0;
+  if (!ha) return false;
+
+  // Objects marked dirty while flushing (by automations, for example) are left for the next flush.
+  STAILQ_FOREACH(o, &ha->dirty, dirty_entry) todo++;
+  while (todo-- > 0 && (o = STAILQ_FIRST(&ha->dirty)) != NULL) {
+    mgos_homeassistant_object_send_status(o);
+  }
+  if (ha->aggregate.pending) mgos_homeassistant_aggregate_send(ha);
+  return true;
+}
+
+bool mgos_homeassistant_object_mark_dirty(struct mgos_homeassistant_object *o) {
+  if (!o || !o->ha) return false;
+  if (o->status_dirty) return true;
+
+  o->status_dirty = true;
+  STAILQ_INSERT_TAIL(&o->ha->dirty, o, dirty_entry);
+  if (o->ha->dirty_timer == MGOS_INVALID_TIMER_ID) {
+    o->ha->dirty_timer = mgos_set_timer(mgos_sys_config_get_homeassistant_status_coalesce_ms(), 0, mgos_homeassistant_dirty_timer_cb, o->ha);
+  }
+  return true;
+}
+
+bool mgos_homeassistant_object_flush_status(struct mgos_homeassistant_object *o) {
   if (!o) return false;
-  if (!o->config_sent) mgos_homeassistant_object_send_config(o);
+  if (o->status_dirty) mgos_homeassistant_object_send_status(o);
+  if (o->aggregated && o->ha->aggregate.pending) mgos_homeassistant_aggregate_send(o->ha);
+  return true;
+}
 
-  mbuf_init(&mbuf_topic, 100);
-  gen_topicprefix(&mbuf_topic, o);
-  mbuf_append_nul(&mbuf_topic);
+// Publishes the status of the object. Unless forced, a status identical to the
+// last one published is suppressed, until homeassistant.status_max_silence
+// seconds have passed since.
+static bool mgos_homeassistant_object_publish_status(struct mgos_homeassistant_object *o, bool force) {
+  if (!o) return false;
+  mgos_homeassistant_object_clear_dirty(o);
+  if (!o->config_sent) mgos_homeassistant_object_send_config(o);
 
   mgos_homeassistant_object_get_status(o);
 
-  LOG(LL_DEBUG, ("Status topic(%d)='%.*s' payload(%d)='%.*s'", (int) mbuf_topic.len, (int) mbuf_topic.len, mbuf_topic.buf, (int) o->status.len, (int) o->status.len, o->status.buf));
-  if (!mgos_mqtt_global_is_connected() || !o->config_sent) {
-    LOG(LL_DEBUG, ("MQTT not connected or config not sent, skipping status for %s", o->object_name));
+  LOG(LL_DEBUG, ("Status topic(%d)='%s' payload(%d)='%.*s'", (int) o->topics.prefix_len, o->topics.prefix, (int) o->status.len, (int) o->status.len,
+                 o->status.buf));
+  if (o->aggregated) {
+    // Published with the other aggregated objects, at the end of this event loop iteration.
+    o->ha->aggregate.pending = true;
+    o->ha->aggregate.force |= force;
+    if (o->ha->dirty_timer == MGOS_INVALID_TIMER_ID) {
+      o->ha->dirty_timer = mgos_set_timer(mgos_sys_config_get_homeassistant_status_coalesce_ms(), 0, mgos_homeassistant_dirty_timer_cb, o->ha);
+    }
+  } else if (!mgos_mqtt_global_is_connected()) {
+    LOG(LL_DEBUG, ("MQTT not connected, keeping status for %s", o->object_name));
+    mgos_homeassistant_object_keep_status(o);
+  } else if (!o->config_sent) {
+    LOG(LL_DEBUG, ("Config not sent, skipping status for %s", o->object_name));
   } else {
-    mgos_mqtt_pub((char *) mbuf_topic.buf, o->status.buf, o->status.len, 0, false);
+    uint32_t hash = content_hash(o->status.buf, o->status.len);
+    int max_silence = mgos_sys_config_get_homeassistant_status_max_silence();
+    double now = mgos_uptime();
+
+    if (!force && max_silence > 0 && o->stats.publishes > 0 && hash == o->status_hash && now - o->status_sent_at < max_silence) {
+      LOG(LL_DEBUG, ("Status unchanged, skipping status for %s", o->object_name));
+      o->stats.suppressed++;
+    } else {
+      mgos_homeassistant_pub(o->ha, o->topics.prefix, o->status.buf, o->status.len, false);
+      o->status_hash = hash;
+      o->status_sent_at = now;
+      o->stats.publishes++;
+      o->stats.bytes += o->status.len;
+    }
   }
 
   mgos_homeassistant_call_handlers(o->ha, MGOS_HOMEASSISTANT_EV_OBJECT_STATUS, o);
-  if (mbuf_topic.size > 0) mbuf_free(&mbuf_topic);
   return true;
 }
 
+bool mgos_homeassistant_object_send_status(struct mgos_homeassistant_object *o) {
+  return mgos_homeassistant_object_publish_status(o, false);
+}
+
+bool mgos_homeassistant_object_refresh_status(struct mgos_homeassistant_object *o) {
+  return mgos_homeassistant_object_publish_status(o, true);
+}
+
 bool mgos_homeassistant_object_log(struct mgos_homeassistant_object *o, const char *json_fmt, ...) {
   va_list ap;
-  struct mbuf mbuf_topic;
 
   if (!o) return false;
-  mbuf_init(&mbuf_topic, 100);
-  gen_topicprefix(&mbuf_topic, o);
-  mbuf_append(&mbuf_topic, "/log", 4);
-  mbuf_append_nul(&mbuf_topic);
 
   va_start(ap, json_fmt);
   if (!mgos_mqtt_global_is_connected()) {
     LOG(LL_DEBUG, ("MQTT not connected, skipping log for %s", o->object_name));
   } else {
-    mgos_mqtt_pubv(mbuf_topic.buf, 0, false, json_fmt, ap);
+    mgos_mqtt_pubv(o->topics.log, 0, false, json_fmt, ap);
   }
   va_end(ap);
-  mbuf_free(&mbuf_topic);
   return true;
 }
 
 static bool mgos_homeassistant_object_send_config_mqtt(struct mgos_homeassistant *ha, struct mgos_homeassistant_object *o,
                                                        struct mgos_homeassistant_object_class *c) {
   if (!ha || !o) return false;
-  struct ha_component_data *hcd = ha_component_data(c ? c->component : o->component);
-  struct mbuf mbuf_topic;
-  struct mbuf mbuf_topicprefix;
-  struct mbuf mbuf_friendlyname;
-  struct mbuf mbuf_payload;
-  struct json_out payload = JSON_OUT_MBUF(&mbuf_payload);
-
-  mbuf_init(&mbuf_topic, 100);
-  mbuf_init(&mbuf_topicprefix, 100);
-  mbuf_init(&mbuf_friendlyname, 50);
-  mbuf_init(&mbuf_payload, 200);
-
-  gen_configtopic(&mbuf_topic, o, c);
-  gen_topicprefix(&mbuf_topicprefix, o);
-  gen_friendlyname(&mbuf_friendlyname, o, c);
-
-  json_printf(&payload, "{\"~\":%.*Q,name:%.*Q", (int) mbuf_topicprefix.len, mbuf_topicprefix.buf, (int) mbuf_friendlyname.len,
-              mbuf_friendlyname.buf);
-  json_printf(&payload, ",uniq_id:\"%s:%.*s\"", mgos_sys_ro_vars_get_mac_address(), (int) mbuf_friendlyname.len, mbuf_friendlyname.buf);
-  json_printf(&payload, ",avty_t:\"%s\"", mgos_sys_config_get_device_id());
-
-  if (hcd->json_config_additional_payload) json_printf(&payload, ",%s", hcd->json_config_additional_payload);
-  if (!hcd->no_stat_t) json_printf(&payload, ",stat_t:%Q", "~");
-  if (mgos_homeassistant_object_get_cmd(o, NULL) && !hcd->no_cmd_t) json_printf(&payload, ",cmd_t:%Q", "~/cmd");
-  if (mgos_homeassistant_object_get_attr(o, NULL)) json_printf(&payload, ",json_attr_t:%Q", "~/attr");
-  if (c && !hcd->no_dev_cla) json_printf(&payload, ",dev_cla:%Q", c->class_name);
-  if (c && !hcd->no_val_tpl) json_printf(&payload, ",val_tpl:\"{{%s%s}}\"", "value_json.", c->class_name);
-  if (c && c->json_config_additional_payload) json_printf(&payload, ",%s", c->json_config_additional_payload);
-  if (o->json_config_additional_payload) json_printf(&payload, ",%s", o->json_config_additional_payload);
-
-  json_printf(&payload, ",dev:{");
-  json_printf(&payload, "name:%Q", mgos_sys_config_get_device_id());
-  json_printf(&payload, ",ids:[%Q]", o->ha->node_name);
-  json_printf(&payload, ",cns:[[mac,%Q]]", mgos_sys_ro_vars_get_mac_address());
-  json_printf(&payload, ",mdl:%Q", mgos_sys_ro_vars_get_app());
-  json_printf(&payload, ",sw:\"%s (%s)\"", mgos_sys_ro_vars_get_fw_version(), mgos_sys_ro_vars_get_fw_id());
-  json_printf(&payload, ",mf:%Q", "Mongoose OS");
-  json_printf(&payload, "}");
+  struct mgos_homeassistant_config_cache *cc = c ? &c->config : &o->config;
+  const char *topic = c ? c->config_topic : o->topics.config;
 
-  json_printf(&payload, "}");
+  if (!mgos_homeassistant_config_render(ha, o, c)) return false;
+  if (cc->sent && cc->sent_hash == cc->hash) {
+    LOG(LL_DEBUG, ("Config: topic='%s' unchanged, skipping", topic));
+    return true;
+  }
 
-  LOG(LL_DEBUG, ("Config: topic='%.*s' payload='%.*s'", (int) mbuf_topic.len, mbuf_topic.buf, (int) mbuf_payload.len, mbuf_payload.buf));
-  mbuf_append_nul(&mbuf_topic);
+  LOG(LL_DEBUG, ("Config: topic='%s' payload='%.*s'", topic, (int) cc->payload.len, cc->payload.buf));
   if (!mgos_mqtt_global_is_connected()) {
     LOG(LL_DEBUG, ("MQTT not connected, skipping config for %s", o->object_name));
     o->config_sent=false;
   } else {
-    mgos_mqtt_pub((char *) mbuf_topic.buf, mbuf_payload.buf, mbuf_payload.len, 0, true);
+    struct mgos_homeassistant_stats *st = c ? &c->stats : &o->stats;
+    mgos_homeassistant_pub(ha, topic, cc->payload.buf, cc->payload.len, true);
+    st->configs++;
+    st->bytes += cc->payload.len;
+    cc->sent = true;
+    cc->sent_hash = cc->hash;
   }
-
-  mbuf_free(&mbuf_topic);
-  mbuf_free(&mbuf_topicprefix);
-  mbuf_free(&mbuf_friendlyname);
-  mbuf_free(&mbuf_payload);
   return true;
 }
 
@@ -609,6 +1609,7 @@ bool mgos_homeassistant_object_send_config(struct mgos_homeassistant_object *o)
 
   if (!o || !o->ha) goto exit;
   if (o->config_sent) goto exit;
+  mgos_homeassistant_check_discovery_prefix(o->ha);
 
   if (o->status_cb || mgos_homeassistant_object_get_cmd(o, NULL) || mgos_homeassistant_object_get_attr(o, NULL) ||
       o->json_config_additional_payload) {
@@ -628,6 +1629,30 @@ exit:
   return ret;
 }
 
+bool mgos_homeassistant_object_get_stats(struct mgos_homeassistant_object *o, struct mgos_homeassistant_stats *stats) {
+  if (!o || !stats) return false;
+  *stats = o->stats;
+  return true;
+}
+
+// Removes the handlers filtered on object o, which is going away. While
+// handlers are being called they are only marked, see
+// mgos_homeassistant_call_handlers().
+static void mgos_homeassistant_object_remove_handlers(struct mgos_homeassistant_object *o) {
+  struct mgos_homeassistant *ha = o->ha;
+  struct mgos_homeassistant_handler *h, *h_tmp;
+
+  SLIST_FOREACH_SAFE(h, &ha->handlers, entry, h_tmp) {
+    if (h->object != o) continue;
+    if (ha->dispatching > 0) {
+      h->removed = true;
+      ha->handlers_removed = true;
+      continue;
+    }
+    mgos_homeassistant_handler_free(ha, h);
+  }
+}
+
 bool mgos_homeassistant_object_remove(struct mgos_homeassistant_object **o) {
   if (!(*o) || !(*o)->ha) return false;
 
@@ -636,17 +1661,13 @@ bool mgos_homeassistant_object_remove(struct mgos_homeassistant_object **o) {
   if ((*o)->pre_remove_cb) (*o)->pre_remove_cb(*o);
   if ((*o)->user_data) LOG(LL_WARN, ("Object '%s' still has user_data, pre_remove_cb() should clean that up!", (*o)->object_name));
 
-  struct mbuf mbuf_topic;
-  mbuf_init(&mbuf_topic, 100);
-  gen_topicprefix(&mbuf_topic, *o);
-  mbuf_append(&mbuf_topic, "/#", 2);
-  mbuf_append_nul(&mbuf_topic);
-  if (!mgos_mqtt_global_is_connected()) {
-    LOG(LL_DEBUG, ("MQTT not connected, skipping unsubscribe for %s", (*o)->object_name));
-  } else {
-    mgos_mqtt_unsub(mbuf_topic.buf);
+  if (!mgos_sys_config_get_homeassistant_node_subscription()) {
+    if (!mgos_mqtt_global_is_connected()) {
+      LOG(LL_DEBUG, ("MQTT not connected, skipping unsubscribe for %s", (*o)->object_name));
+    } else {
+      mgos_mqtt_unsub((*o)->topics.sub);
+    }
   }
-  mbuf_free(&mbuf_topic);
 
   while (!SLIST_EMPTY(&(*o)->classes)) {
     struct mgos_homeassistant_object_class *c;
@@ -668,38 +1689,60 @@ bool mgos_homeassistant_object_remove(struct mgos_homeassistant_object **o) {
     mgos_homeassistant_object_remove_attr(&a);
   }
 
-  if ((*o)->object_name) free((*o)->object_name);
-  if ((*o)->json_config_additional_payload) free((*o)->json_config_additional_payload);
-  if ((*o)->status.size > 0) mbuf_free(&(*o)->status);
-
+  if ((*o)->ha->announce.next == *o) (*o)->ha->announce.next = SLIST_NEXT(*o, entry);
+  mgos_homeassistant_object_clear_dirty(*o);
+  mgos_homeassistant_offline_forget(*o, false);
+  mgos_homeassistant_object_remove_handlers(*o);
+  mgos_homeassistant_object_index_remove((*o)->ha, *o);
   SLIST_REMOVE(&(*o)->ha->objects, (*o), mgos_homeassistant_object, entry);
 
-  free(*o);
+  mgos_homeassistant_payload_free((*o)->ha, (*o)->json_config_additional_payload, (*o)->payload_static);
+  if ((*o)->status.size > 0) mbuf_free(&(*o)->status);
+  if ((*o)->topics.buf) free((*o)->topics.buf);
+  mbuf_free(&(*o)->config.payload);
+  mgos_homeassistant_name_release((*o)->ha, (*o)->object_name);
+
+  mgos_homeassistant_free((*o)->ha, *o, sizeof(**o));
   *o = NULL;
   return true;
 }
 
-struct mgos_homeassistant_object_class *mgos_homeassistant_object_class_add(struct mgos_homeassistant_object *o, const char *class_name,
-                                                                            const char *json_config_additional_payload, ha_status_cb status_cb) {
-  struct mgos_homeassistant_object_class *c = calloc(1, sizeof(*c));
+static struct mgos_homeassistant_object_class *mgos_homeassistant_object_class_create(struct mgos_homeassistant_object *o, const char *class_name,
+                                                                                      const char *json_config_additional_payload,
+                                                                                      bool payload_static, ha_status_cb status_cb) {
+  struct mgos_homeassistant_object_class *c;
 
-  if (!c || !o || !class_name) return NULL;
+  if (!o || !class_name) return NULL;
   if (!mgos_homeassistant_isvalid_name(class_name)) {
     LOG(LL_ERROR, ("Invalid class name '%s'", class_name));
-    free(c);
     return NULL;
   }
   if (mgos_homeassistant_exists_classname(o, class_name)) {
     LOG(LL_ERROR, ("Class name '%s' already exists in object '%s'", class_name, o->object_name));
-    free(c);
     return NULL;
   }
+  if (!(c = mgos_homeassistant_alloc(o->ha, sizeof(*c)))) return NULL;
 
   c->object = o;
   c->component = o->component;
-  c->class_name = strdup(class_name);
-  if (json_config_additional_payload) c->json_config_additional_payload = strdup(json_config_additional_payload);
+  if (!(c->class_name = mgos_homeassistant_name_intern(o->ha, class_name))) {
+    mgos_homeassistant_free(o->ha, c, sizeof(*c));
+    return NULL;
+  }
+  c->payload_static = payload_static;
+  if (json_config_additional_payload)
+    c->json_config_additional_payload =
+        payload_static ? (char *) json_config_additional_payload : mgos_homeassistant_strdup(o->ha, json_config_additional_payload);
   c->status_cb = status_cb;
+  mbuf_init(&c->config.payload, 0);
+  if (!mgos_homeassistant_object_class_build_topics(c)) {
+    LOG(LL_ERROR, ("Could not build topics for class '%s'", class_name));
+    mbuf_free(&c->config.payload);
+    mgos_homeassistant_payload_free(o->ha, c->json_config_additional_payload, c->payload_static);
+    mgos_homeassistant_name_release(o->ha, c->class_name);
+    mgos_homeassistant_free(o->ha, c, sizeof(*c));
+    return NULL;
+  }
   SLIST_INSERT_HEAD(&o->classes, c, entry);
 
   // Force a config update to be sent upon next status
@@ -709,6 +1752,17 @@ struct mgos_homeassistant_object_class *mgos_homeassistant_object_class_add(stru
   return c;
 }
 
+struct mgos_homeassistant_object_class *mgos_homeassistant_object_class_add(struct mgos_homeassistant_object *o, const char *class_name,
+                                                                            const char *json_config_additional_payload, ha_status_cb status_cb) {
+  return mgos_homeassistant_object_class_create(o, class_name, json_config_additional_payload, false, status_cb);
+}
+
+struct mgos_homeassistant_object_class *mgos_homeassistant_object_class_add_static(struct mgos_homeassistant_object *o, const char *class_name,
+                                                                                   const char *json_config_additional_payload,
+                                                                                   ha_status_cb status_cb) {
+  return mgos_homeassistant_object_class_create(o, class_name, json_config_additional_payload, true, status_cb);
+}
+
 struct mgos_homeassistant_object_class *mgos_homeassistant_object_class_get(struct mgos_homeassistant_object *o, const char *suffix) {
   struct mgos_homeassistant_object_class *c = NULL;
   if (!o || !suffix) return NULL;
@@ -733,25 +1787,79 @@ bool mgos_homeassistant_object_class_remove(struct mgos_homeassistant_object_cla
   if (!(*c) || !(*c)->object) return false;
 
   LOG(LL_DEBUG, ("Removing class '%s' from object '%s'", (*c)->class_name, (*c)->object->object_name));
-  mgos_homeassistant_call_handlers((*c)->object->ha, MGOS_HOMEASSISTANT_EV_CLASS_REMOVE, c);
+  mgos_homeassistant_call_handlers((*c)->object->ha, MGOS_HOMEASSISTANT_EV_CLASS_REMOVE, *c);
 
-  if ((*c)->class_name) free((*c)->class_name);
-  if ((*c)->json_config_additional_payload) free((*c)->json_config_additional_payload);
+  struct mgos_homeassistant *ha = (*c)->object->ha;
+  mgos_homeassistant_name_release(ha, (*c)->class_name);
+  mgos_homeassistant_payload_free(ha, (*c)->json_config_additional_payload, (*c)->payload_static);
+  if ((*c)->config_topic) free((*c)->config_topic);
+  mbuf_free(&(*c)->config.payload);
 
   SLIST_REMOVE(&(*c)->object->classes, (*c), mgos_homeassistant_object_class, entry);
 
-  free(*c);
+  mgos_homeassistant_free(ha, *c, sizeof(**c));
   *c = NULL;
   return true;
 }
 
+bool mgos_homeassistant_object_class_get_stats(struct mgos_homeassistant_object_class *c, struct mgos_homeassistant_stats *stats) {
+  if (!c || !stats) return false;
+  *stats = c->stats;
+  return true;
+}
+
+uint32_t mgos_homeassistant_name_hash(const char *s, size_t len) {
+  if (!s) return 0;
+  return name_hash(s, len);
+}
+
+bool mgos_homeassistant_arena_stats(struct mgos_homeassistant *ha, struct mgos_homeassistant_arena_stats *stats) {
+  if (!ha || !stats) return false;
+  *stats = ha->arena.stats;
+  stats->fragmentation = stats->reserved ? (uint8_t)((stats->reserved - stats->used) * 100 / stats->reserved) : 0;
+  return true;
+}
+
 bool mgos_homeassistant_add_handler(struct mgos_homeassistant *ha, ha_ev_handler ev_handler, void *user_data) {
+  return mgos_homeassistant_add_handler_mask(ha, ev_handler, MGOS_HOMEASSISTANT_EVM_ALL, NULL, user_data);
+}
+
+bool mgos_homeassistant_add_handler_mask(struct mgos_homeassistant *ha, ha_ev_handler ev_handler, uint32_t ev_mask,
+                                         struct mgos_homeassistant_object *object, void *user_data) {
   struct mgos_homeassistant_handler *h;
 
-  if (!ha || !ev_handler) return false;
+  if (!ha || !ev_handler || !(ev_mask & MGOS_HOMEASSISTANT_EVM_ALL)) return false;
+  for (int i = 0; i < MGOS_HOMEASSISTANT_EV_COUNT; i++) {
+    if (!(ev_mask & (1 << i)) || ha->ev_handlers_len[i] < UINT8_MAX) continue;
+    LOG(LL_ERROR, ("Too many handlers for event bit %d", i));
+    return false;
+  }
   if (!(h = calloc(1, sizeof(*h)))) return false;
   h->ev_handler = ev_handler;
   h->user_data = user_data;
+  h->ev_mask = ev_mask & MGOS_HOMEASSISTANT_EVM_ALL;
+  h->object = object;
+
+  // Newest handlers are called first, as they always were.
+  for (int i = 0; i < MGOS_HOMEASSISTANT_EV_COUNT; i++) {
+    struct mgos_homeassistant_handler **hs;
+    if (!(h->ev_mask & (1 << i))) continue;
+    if (!(hs = realloc(ha->ev_handlers[i], (ha->ev_handlers_len[i] + 1) * sizeof(*hs)))) {
+      LOG(LL_ERROR, ("Could not add handler for event bit %d", i));
+      // Take the handler out of the arrays it went into already.
+      while (--i >= 0) {
+        if (!(h->ev_mask & (1 << i))) continue;
+        ha->ev_handlers_len[i]--;
+        memmove(ha->ev_handlers[i], ha->ev_handlers[i] + 1, ha->ev_handlers_len[i] * sizeof(*hs));
+      }
+      free(h);
+      return false;
+    }
+    memmove(hs + 1, hs, ha->ev_handlers_len[i] * sizeof(*hs));
+    hs[0] = h;
+    ha->ev_handlers[i] = hs;
+    ha->ev_handlers_len[i]++;
+  }
 
   SLIST_INSERT_HEAD(&ha->handlers, h, entry);
   mgos_homeassistant_call_handlers(ha, MGOS_HOMEASSISTANT_EV_ADD_HANDLER, NULL);
@@ -16,6 +16,8 @@
 
 #include "mgos_homeassistant_automation.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
@@ -40,11 +42,248 @@ static char *strstrn(const char *haystack, const char *needle, size_t slen) {
   return ((char *) haystack);
 }
 
+// The scalar fields of one object status, parsed once and shared by all the
+// matchers evaluated against it. Tokens point into the object's status buffer.
+#define MGOS_HOMEASSISTANT_AUTOMATION_FIELDS 16
+struct mgos_homeassistant_automation_fields {
+  const struct mgos_homeassistant_object *o;
+  int len;
+  struct {
+    uint32_t hash;
+    uint16_t path_len;
+    struct json_token tok;
+  } field[MGOS_HOMEASSISTANT_AUTOMATION_FIELDS];
+};
+
+// Scratch fields for statuses that are not the one of the current event.
+static struct mgos_homeassistant_automation_fields s_fields;
+
+// FNV-1a, as paths are case sensitive.
+static uint32_t mgos_homeassistant_automation_path_hash(const char *s, size_t len) {
+  uint32_t hash = 2166136261u;
+  while (len--) {
+    hash ^= (uint8_t) *s++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void mgos_homeassistant_automation_fields_cb(void *callback_data, const char *name, size_t name_len, const char *path,
+                                                    const struct json_token *token) {
+  struct mgos_homeassistant_automation_fields *f = callback_data;
+  size_t path_len;
+
+  if (token->type < JSON_TYPE_STRING || token->type > JSON_TYPE_NULL) return;
+  if (f->len >= MGOS_HOMEASSISTANT_AUTOMATION_FIELDS) return;
+  path_len = strlen(path);
+  f->field[f->len].hash = mgos_homeassistant_automation_path_hash(path, path_len);
+  f->field[f->len].path_len = path_len;
+  f->field[f->len].tok = *token;
+  f->len++;
+  (void) name;
+  (void) name_len;
+}
+
+// Returns the parsed fields of the status of object o. The event fields f are
+// reused if they hold the status of o, and filled if they are still empty.
+static const struct mgos_homeassistant_automation_fields *mgos_homeassistant_automation_fields_get(struct mgos_homeassistant_automation_fields *f,
+                                                                                                   const struct mgos_homeassistant_object *o) {
+  if (f && f->o == o) return f;
+  if (!f || f->o) f = &s_fields;
+  f->o = o;
+  f->len = 0;
+  if (o->status.len > 0) json_walk(o->status.buf, o->status.len, mgos_homeassistant_automation_fields_cb, f);
+  return f;
+}
+
+static bool mgos_homeassistant_automation_number(const char *s, int len, double *d) {
+  char buf[32], *end;
+
+  if (len <= 0 || len >= (int) sizeof(buf)) return false;
+  memcpy(buf, s, len);
+  buf[len] = 0;
+  *d = strtod(buf, &end);
+  return end == buf + len;
+}
+
+static bool mgos_homeassistant_automation_value_eq(const char *value, const struct json_token *tok) {
+  double a, b;
+
+  if (tok->type == JSON_TYPE_NUMBER && mgos_homeassistant_automation_number(value, strlen(value), &a) &&
+      mgos_homeassistant_automation_number(tok->ptr, tok->len, &b))
+    return a == b;
+  return (int) strlen(value) == tok->len && 0 == strncmp(value, tok->ptr, tok->len);
+}
+
+static const struct json_token *mgos_homeassistant_automation_fields_find(const struct mgos_homeassistant_automation_fields *f, uint32_t hash,
+                                                                         uint16_t path_len) {
+  int i;
+
+  for (i = 0; i < f->len; i++)
+    if (f->field[i].hash == hash && f->field[i].path_len == path_len) return &f->field[i].tok;
+  return NULL;
+}
+
+// Returns the frozen path of a configured path, which may omit the leading
+// dot, and its hash and length.
+static char *mgos_homeassistant_automation_path_create(const char *path, uint32_t *hash, uint16_t *path_len) {
+  char *ret;
+
+  if (!(ret = malloc(strlen(path) + 2))) return NULL;
+  sprintf(ret, "%s%s", path[0] == '.' ? "" : ".", path);
+  *path_len = strlen(ret);
+  *hash = mgos_homeassistant_automation_path_hash(ret, *path_len);
+  return ret;
+}
+
+// Applies op to field tok, given whether it equals one of the values of eq, ne
+// or in, or the number of lt and gt.
+static bool mgos_homeassistant_automation_compare(const struct json_token *tok, enum mgos_homeassistant_automation_op op, double number,
+                                                  bool equal) {
+  double d;
+
+  // A missing field is unequal to everything.
+  if (!tok) return op == OP_NE;
+
+  switch (op) {
+    case OP_LT:
+    case OP_GT:
+      if (!mgos_homeassistant_automation_number(tok->ptr, tok->len, &d)) return false;
+      return op == OP_LT ? d < number : d > number;
+    case OP_NE:
+      return !equal;
+    default:
+      return equal;
+  }
+}
+
+static bool mgos_homeassistant_automation_matcher_eval(const struct mgos_homeassistant_automation_matcher *m,
+                                                       const struct mgos_homeassistant_automation_fields *f) {
+  const struct json_token *tok = mgos_homeassistant_automation_fields_find(f, m->hash, m->path_len);
+  bool equal = false;
+  int i;
+
+  for (i = 0; tok && !equal && i < m->values_len; i++) equal = mgos_homeassistant_automation_value_eq(m->values[i], tok);
+  return mgos_homeassistant_automation_compare(tok, m->op, m->number, equal);
+}
+
+static char *mgos_homeassistant_automation_strndup(const char *s, int len) {
+  char *ret = malloc(len + 1);
+  if (!ret) return NULL;
+  memcpy(ret, s, len);
+  ret[len] = 0;
+  return ret;
+}
+
+static void mgos_homeassistant_automation_matcher_destroy(struct mgos_homeassistant_automation_matcher *m) {
+  int i;
+
+  if (!m) return;
+  for (i = 0; i < m->values_len; i++) free(m->values[i]);
+  if (m->values) free(m->values);
+  if (m->path) free(m->path);
+  free(m);
+}
+
+static bool mgos_homeassistant_automation_matcher_add_value(struct mgos_homeassistant_automation_matcher *m, const struct json_token *tok) {
+  char **values;
+
+  if (!(values = realloc(m->values, (m->values_len + 1) * sizeof(*values)))) return false;
+  m->values = values;
+  if (!(m->values[m->values_len] = mgos_homeassistant_automation_strndup(tok->ptr, tok->len))) return false;
+  m->values_len++;
+  return true;
+}
+
+// Compiles the path, op and value of a status trigger or condition. Returns
+// false if they are invalid, and true with *mp NULL if there is no path.
+static bool mgos_homeassistant_automation_matcher_create(struct json_token json, struct mgos_homeassistant_automation_matcher **mp) {
+  struct mgos_homeassistant_automation_matcher *m = NULL;
+  struct json_token value = {0}, v;
+  char *path = NULL, *op = NULL;
+  void *h = NULL;
+  int idx;
+  bool ret = false;
+
+  *mp = NULL;
+  json_scanf(json.ptr, json.len, "{path:%Q,op:%Q,value:%T}", &path, &op, &value);
+  if (!path) {
+    ret = true;
+    goto exit;
+  }
+  if (!(m = calloc(1, sizeof(*m)))) goto exit;
+  if (!(m->path = mgos_homeassistant_automation_path_create(path, &m->hash, &m->path_len))) goto exit;
+
+  if (!op || 0 == strcasecmp(op, "eq"))
+    m->op = OP_EQ;
+  else if (0 == strcasecmp(op, "ne"))
+    m->op = OP_NE;
+  else if (0 == strcasecmp(op, "in"))
+    m->op = OP_IN;
+  else if (0 == strcasecmp(op, "lt"))
+    m->op = OP_LT;
+  else if (0 == strcasecmp(op, "gt"))
+    m->op = OP_GT;
+  else {
+    LOG(LL_WARN, ("Unknown op '%s'", op));
+    goto exit;
+  }
+
+  if (!value.ptr) {
+    LOG(LL_WARN, ("Path '%s' has no value", m->path));
+    goto exit;
+  }
+  if (m->op == OP_LT || m->op == OP_GT) {
+    if (!mgos_homeassistant_automation_number(value.ptr, value.len, &m->number)) {
+      LOG(LL_WARN, ("Path '%s' op '%s' needs a number, not '%.*s'", m->path, op, (int) value.len, value.ptr));
+      goto exit;
+    }
+  } else if (value.len > 0 && value.ptr[0] == '[') {
+    while ((h = json_next_elem(value.ptr, value.len, h, "", &idx, &v)) != NULL)
+      if (!mgos_homeassistant_automation_matcher_add_value(m, &v)) goto exit;
+  } else if (!mgos_homeassistant_automation_matcher_add_value(m, &value)) {
+    goto exit;
+  }
+
+  *mp = m;
+  m = NULL;
+  ret = true;
+exit:
+  mgos_homeassistant_automation_matcher_destroy(m);
+  if (path) free(path);
+  if (op) free(op);
+  return ret;
+}
+
+static void mgos_homeassistant_automation_data_status_free(struct mgos_homeassistant_automation_data_status *dd) {
+  if (dd->object) free(dd->object);
+  if (dd->status) free(dd->status);
+  mgos_homeassistant_automation_matcher_destroy(dd->matcher);
+  free(dd);
+}
+
+// Matches the status of object o, using the fields in f if they are parsed
+// from it already.
+static bool trigger_status_match(struct mgos_homeassistant_object *o, struct mgos_homeassistant_automation_data_status *data,
+                                 struct mgos_homeassistant_automation_fields *f) {
+  bool ret;
+
+  if (data->matcher) {
+    ret = mgos_homeassistant_automation_matcher_eval(data->matcher, mgos_homeassistant_automation_fields_get(f, o));
+    LOG(LL_DEBUG, ("Trigger: Object('%s') path '%s' %smatches", o->object_name, data->matcher->path, ret ? "" : "no "));
+    return ret;
+  }
+
+  ret = NULL != strstrn(o->status.buf, data->status, o->status.len);
+  LOG(LL_DEBUG,
+      ("Trigger: Object('%s').status='%.*s' %s= data('%s')", o->object_name, (int) o->status.len, o->status.buf, ret ? "" : "!", data->status));
+  return ret;
+}
+
 static bool trigger_status(struct mgos_homeassistant *ha, struct mgos_homeassistant_automation_data_status *trigger_data,
                            struct mgos_homeassistant_automation_data_status *data) {
   struct mgos_homeassistant_object *o;
   int ret;
-  char *p;
 
   if (!ha || !data || !trigger_data) return false;
 
@@ -52,60 +291,693 @@ static bool trigger_status(struct mgos_homeassistant *ha, struct mgos_homeassist
   LOG(LL_DEBUG, ("Trigger: trigger('%s') %s= data('%s')", trigger_data->object, ret == 0 ? "" : "!", data->object));
   if (0 != ret) return false;
 
-  if (!(o = mgos_homeassistant_object_get(ha, trigger_data->object))) {
-    LOG(LL_ERROR, ("Trigger: Object '%s' not found", trigger_data->object));
+  if (!(o = data->o)) {
+    LOG(LL_DEBUG, ("Trigger: Object '%s' not found", data->object));
     return false;
   }
 
-  p = strstrn(o->status.buf, data->status, o->status.len);
-  LOG(LL_DEBUG,
-      ("Trigger: Object('%s').status='%.*s' %s= data('%s')", o->object_name, (int) o->status.len, o->status.buf, p ? "" : "!", data->status));
+  return trigger_status_match(o, data, NULL);
+}
+
+// Follows the value of the threshold field in the status of object o, and
+// returns true upon the status that completes a crossing.
+static bool trigger_threshold_match(struct mgos_homeassistant_object *o, struct mgos_homeassistant_automation_data_threshold *data,
+                                    struct mgos_homeassistant_automation_fields *f) {
+  const struct json_token *tok;
+  double value, now;
+  bool beyond;
 
-  return p != NULL;
+  tok = mgos_homeassistant_automation_fields_find(mgos_homeassistant_automation_fields_get(f, o), data->hash, data->path_len);
+  if (!tok || !mgos_homeassistant_automation_number(tok->ptr, tok->len, &value)) return false;
+  beyond = data->above ? value > data->threshold : value < data->threshold;
+  LOG(LL_DEBUG, ("Trigger: Object('%s') path '%s' value %.3f %s threshold %.3f", o->object_name, data->path, value, beyond ? "beyond" : "within",
+                 data->threshold));
+
+  if (data->fired) {
+    if (data->above ? value < data->threshold - data->hysteresis : value > data->threshold + data->hysteresis) data->fired = false;
+    return false;
+  }
+  if (!beyond) {
+    data->since = 0;
+    return false;
+  }
+  now = mgos_uptime();
+  if (data->since == 0) data->since = now;
+  if (now - data->since < data->dwell) return false;
+  data->fired = true;
+  data->since = 0;
+  return true;
 }
 
-static bool condition_status(struct mgos_homeassistant *ha, struct mgos_homeassistant_automation_data_status *data) {
-  struct mgos_homeassistant_object *o;
-  char *p;
+static bool trigger_threshold(struct mgos_homeassistant *ha, struct mgos_homeassistant_automation_data_status *trigger_data,
+                              struct mgos_homeassistant_automation_data_threshold *data) {
+  if (!ha || !data || !trigger_data || !data->o) return false;
+  if (0 != strcasecmp(trigger_data->object, data->object)) return false;
+  return trigger_threshold_match(data->o, data, NULL);
+}
 
-  if (!ha || !data) return true;
-  if (!(o = mgos_homeassistant_object_get(ha, data->object))) return true;
+static void mgos_homeassistant_automation_data_threshold_free(struct mgos_homeassistant_automation_data_threshold *dd) {
+  if (dd->object) free(dd->object);
+  if (dd->path) free(dd->path);
+  free(dd);
+}
 
-  p = strstrn(o->status.buf, data->status, o->status.len);
-  LOG(LL_DEBUG,
-      ("Condition: Object('%s').status='%.*s' %s= data('%s')", o->object_name, (int) o->status.len, o->status.buf, p ? "" : "!", data->status));
+// Compiles a threshold trigger, which needs an object, a path and either of
+// above or below.
+static struct mgos_homeassistant_automation_data_threshold *mgos_homeassistant_automation_data_threshold_create(struct json_token json) {
+  struct mgos_homeassistant_automation_data_threshold *dd = calloc(1, sizeof(*dd));
+  struct json_token above = {0}, below = {0};
+  char *path = NULL;
 
-  return p != NULL;
+  if (!dd) return NULL;
+  json_scanf(json.ptr, json.len, "{object:%Q,path:%Q,above:%T,below:%T,hysteresis:%lf,dwell:%lf}", &dd->object, &path, &above, &below,
+             &dd->hysteresis, &dd->dwell);
+  if (!dd->object || !path || (!above.ptr == !below.ptr)) goto err;
+  dd->above = above.ptr != NULL;
+  if (dd->above && !mgos_homeassistant_automation_number(above.ptr, above.len, &dd->threshold)) goto err;
+  if (!dd->above && !mgos_homeassistant_automation_number(below.ptr, below.len, &dd->threshold)) goto err;
+  if (dd->hysteresis < 0) dd->hysteresis = 0;
+  if (!(dd->path = mgos_homeassistant_automation_path_create(path, &dd->hash, &dd->path_len))) goto err;
+  free(path);
+  return dd;
+err:
+  if (path) free(path);
+  mgos_homeassistant_automation_data_threshold_free(dd);
+  return NULL;
 }
 
-static void action_mqtt(struct mgos_homeassistant_automation_data_action_mqtt *data) {
-  if (!data) return;
+static bool condition_status(struct mgos_homeassistant_object *o, const char *status) {
+  bool ret = NULL != strstrn(o->status.buf, status, o->status.len);
 
-  LOG(LL_INFO, ("Action: MQTT topic='%s' payload='%s'", data->topic, data->payload));
-  mgos_mqtt_pub(data->topic, data->payload, strlen(data->payload), 0, false);
+  LOG(LL_DEBUG, ("Condition: Object('%s').status='%.*s' %s= data('%s')", o->object_name, (int) o->status.len, o->status.buf, ret ? "" : "!", status));
+  return ret;
+}
+
+static void action_mqtt(const char *topic, const char *payload) {
+  if (!topic) return;
+  if (!payload) payload = "";
+
+  LOG(LL_INFO, ("Action: MQTT topic='%s' payload='%s'", topic, payload));
+  mgos_mqtt_pub(topic, payload, strlen(payload), 0, false);
   return;
 }
 
-static bool action_command(struct mgos_homeassistant *ha, struct mgos_homeassistant_automation_data_action_command *data) {
-  struct mgos_homeassistant_object *o;
-  if (!ha || !data) return false;
-  if (!(o = mgos_homeassistant_object_get(ha, data->object))) {
-    LOG(LL_ERROR, ("Action: Object '%s' not found", data->object));
+static bool action_command(struct mgos_homeassistant_object *o, const char *object, const char *cmd_name, const char *payload) {
+  if (!o) {
+    LOG(LL_DEBUG, ("Action: Object '%s' not found", object));
     return false;
   }
+  if (!payload) payload = "";
 
-  LOG(LL_INFO, ("Action: Command object='%s' command='%s' payload='%s'", data->object, data->cmd_name ? data->cmd_name : "(default)", data->payload));
-  mgos_homeassistant_object_cmd(o, data->cmd_name, data->payload, strlen(data->payload));
+  LOG(LL_INFO, ("Action: Command object='%s' command='%s' payload='%s'", object, cmd_name ? cmd_name : "(default)", payload));
+  mgos_homeassistant_object_cmd(o, cmd_name, payload, strlen(payload));
 
   return true;
 }
 
+// Returns the object reference of the automation data and its name, or NULL
+// if the data does not refer to an object.
+static struct mgos_homeassistant_object **mgos_homeassistant_automation_data_ref(struct mgos_homeassistant_automation_data *d, const char **name) {
+  if (!d->data) return NULL;
+  switch (d->type) {
+    case TRIGGER_STATUS:
+    case CONDITION_STATUS: {
+      struct mgos_homeassistant_automation_data_status *dd = d->data;
+      *name = dd->object;
+      return &dd->o;
+    }
+    case TRIGGER_THRESHOLD: {
+      struct mgos_homeassistant_automation_data_threshold *dd = d->data;
+      *name = dd->object;
+      return &dd->o;
+    }
+    default:
+      return NULL;
+  }
+}
+
+static bool endswith(const char *str, const char *suffix) {
+  size_t str_len = strlen(str), suffix_len = strlen(suffix);
+  return suffix_len <= str_len && 0 == strcmp(str + str_len - suffix_len, suffix);
+}
+
+// Updates an object reference to name, as mgos_homeassistant_object_get()
+// would resolve it, upon event ev for object o. Upon ev 0 it is resolved, and
+// reported if it does not resolve.
+static void mgos_homeassistant_automation_bind_ref(struct mgos_homeassistant *ha, struct mgos_homeassistant_object **ref, const char *name, int ev,
+                                                   struct mgos_homeassistant_object *o) {
+  struct mgos_homeassistant_object *other;
+
+  switch (ev) {
+    case MGOS_HOMEASSISTANT_EV_OBJECT_ADD:
+      // The newest object ending in name is the one it resolves to.
+      if (endswith(o->object_name, name)) *ref = o;
+      break;
+    case MGOS_HOMEASSISTANT_EV_OBJECT_REMOVE:
+      if (*ref != o) break;
+      *ref = NULL;
+      SLIST_FOREACH(other, &ha->objects, entry) {
+        if (other != o && endswith(other->object_name, name)) {
+          *ref = other;
+          break;
+        }
+      }
+      break;
+    default:
+      if (!(*ref = mgos_homeassistant_object_get(ha, name))) LOG(LL_WARN, ("Automation refers to object '%s', which does not exist (yet)", name));
+  }
+}
+
+// Updates the object references of a list of automation data.
+static void mgos_homeassistant_automation_bind(struct mgos_homeassistant *ha, struct mgos_homeassistant_automation_data *d, int ev,
+                                               struct mgos_homeassistant_object *o) {
+  for (; d; d = SLIST_NEXT(d, entry)) {
+    struct mgos_homeassistant_object **ref;
+    const char *name = NULL;
+
+    if (!(ref = mgos_homeassistant_automation_data_ref(d, &name)) || !name) continue;
+    mgos_homeassistant_automation_bind_ref(ha, ref, name, ev, o);
+  }
+}
+
+// Instructions of a compiled automation. Operands follow the opcode byte: ref
+// is a uint8_t index into the object references and str a uint16_t offset
+// into the strings, or MGOS_HOMEASSISTANT_AUTOMATION_NO_STR.
+enum mgos_homeassistant_automation_insn {
+  INSN_END = 0,
+  INSN_STATUS,   // ref, str status
+  INSN_MATCH,    // ref, str path, uint32_t hash, uint16_t path_len, uint8_t op, then a double for lt and gt, or uint8_t n and n str
+                 // values for eq, ne and in
+  INSN_MQTT,     // str topic, str payload
+  INSN_COMMAND,  // ref, str command, str payload
+  INSN_DELAY     // uint32_t ms
+};
+
+#define MGOS_HOMEASSISTANT_AUTOMATION_NO_STR 0xffff
+#define MGOS_HOMEASSISTANT_AUTOMATION_CODE(p) ((const uint8_t *) &(p)->refs[(p)->refs_len])
+
+static const char *mgos_homeassistant_automation_str(const struct mgos_homeassistant_automation_program *p, uint16_t str) {
+  if (str == MGOS_HOMEASSISTANT_AUTOMATION_NO_STR) return NULL;
+  return (const char *) MGOS_HOMEASSISTANT_AUTOMATION_CODE(p) + p->code_len + str;
+}
+
+static uint16_t mgos_homeassistant_automation_get16(const uint8_t **pc) {
+  uint16_t v;
+  memcpy(&v, *pc, sizeof(v));
+  *pc += sizeof(v);
+  return v;
+}
+
+static uint32_t mgos_homeassistant_automation_get32(const uint8_t **pc) {
+  uint32_t v;
+  memcpy(&v, *pc, sizeof(v));
+  *pc += sizeof(v);
+  return v;
+}
+
+static double mgos_homeassistant_automation_get_double(const uint8_t **pc) {
+  double v;
+  memcpy(&v, *pc, sizeof(v));
+  *pc += sizeof(v);
+  return v;
+}
+
+struct mgos_homeassistant_automation_builder {
+  struct mgos_homeassistant *ha;
+  struct mbuf refs;
+  struct mbuf conditions;
+  struct mbuf actions;
+  struct mbuf strings;
+  bool ok;
+};
+
+static void mgos_homeassistant_automation_put(struct mgos_homeassistant_automation_builder *b, struct mbuf *m, const void *data, size_t len) {
+  if (mbuf_append(m, data, len) != len) b->ok = false;
+}
+
+// Returns the offset of string s in the strings, adding it if it is not
+// there yet.
+static uint16_t mgos_homeassistant_automation_put_str(struct mgos_homeassistant_automation_builder *b, const char *s) {
+  size_t off = 0, len;
+
+  if (!s) return MGOS_HOMEASSISTANT_AUTOMATION_NO_STR;
+  while (off < b->strings.len) {
+    if (0 == strcmp(b->strings.buf + off, s)) return off;
+    off += strlen(b->strings.buf + off) + 1;
+  }
+  len = strlen(s) + 1;
+  if (off + len >= MGOS_HOMEASSISTANT_AUTOMATION_NO_STR) {
+    b->ok = false;
+    return MGOS_HOMEASSISTANT_AUTOMATION_NO_STR;
+  }
+  mgos_homeassistant_automation_put(b, &b->strings, s, len);
+  return off;
+}
+
+// Returns the index of the reference to object name, adding and resolving it
+// if there is none yet.
+static uint8_t mgos_homeassistant_automation_put_ref(struct mgos_homeassistant_automation_builder *b, const char *name) {
+  struct mgos_homeassistant_automation_ref ref = {NULL, mgos_homeassistant_automation_put_str(b, name)};
+  const struct mgos_homeassistant_automation_ref *refs = (const struct mgos_homeassistant_automation_ref *) b->refs.buf;
+  size_t i, n = b->refs.len / sizeof(ref);
+
+  // Names are interned, equal names have equal offsets.
+  for (i = 0; i < n; i++)
+    if (refs[i].name == ref.name) return i;
+  if (n >= UINT8_MAX) {
+    b->ok = false;
+    return 0;
+  }
+  if (b->ha) mgos_homeassistant_automation_bind_ref(b->ha, &ref.o, name, 0, NULL);
+  mgos_homeassistant_automation_put(b, &b->refs, &ref, sizeof(ref));
+  return n;
+}
+
+static void mgos_homeassistant_automation_put_condition(struct mgos_homeassistant_automation_builder *b,
+                                                        struct mgos_homeassistant_automation_data *d) {
+  struct mgos_homeassistant_automation_data_status *dd = d->data;
+  struct mbuf *m = &b->conditions;
+  uint8_t insn, ref, op, n;
+  uint16_t str;
+  int i;
+
+  if (d->type != CONDITION_STATUS || !dd || !dd->object) return;
+  ref = mgos_homeassistant_automation_put_ref(b, dd->object);
+  if (dd->matcher) {
+    const struct mgos_homeassistant_automation_matcher *mt = dd->matcher;
+    insn = INSN_MATCH;
+    op = mt->op;
+    str = mgos_homeassistant_automation_put_str(b, mt->path);
+    mgos_homeassistant_automation_put(b, m, &insn, sizeof(insn));
+    mgos_homeassistant_automation_put(b, m, &ref, sizeof(ref));
+    mgos_homeassistant_automation_put(b, m, &str, sizeof(str));
+    mgos_homeassistant_automation_put(b, m, &mt->hash, sizeof(mt->hash));
+    mgos_homeassistant_automation_put(b, m, &mt->path_len, sizeof(mt->path_len));
+    mgos_homeassistant_automation_put(b, m, &op, sizeof(op));
+    if (mt->op == OP_LT || mt->op == OP_GT) {
+      mgos_homeassistant_automation_put(b, m, &mt->number, sizeof(mt->number));
+      return;
+    }
+    if (mt->values_len > UINT8_MAX) b->ok = false;
+    n = mt->values_len;
+    mgos_homeassistant_automation_put(b, m, &n, sizeof(n));
+    for (i = 0; i < n; i++) {
+      str = mgos_homeassistant_automation_put_str(b, mt->values[i]);
+      mgos_homeassistant_automation_put(b, m, &str, sizeof(str));
+    }
+  } else if (dd->status) {
+    insn = INSN_STATUS;
+    str = mgos_homeassistant_automation_put_str(b, dd->status);
+    mgos_homeassistant_automation_put(b, m, &insn, sizeof(insn));
+    mgos_homeassistant_automation_put(b, m, &ref, sizeof(ref));
+    mgos_homeassistant_automation_put(b, m, &str, sizeof(str));
+  }
+}
+
+static void mgos_homeassistant_automation_put_action(struct mgos_homeassistant_automation_builder *b, struct mgos_homeassistant_automation_data *d) {
+  struct mbuf *m = &b->actions;
+  uint8_t insn, ref;
+  uint16_t str[2];
+
+  if (!d->data) return;
+  switch (d->type) {
+    case ACTION_MQTT: {
+      struct mgos_homeassistant_automation_data_action_mqtt *dd = d->data;
+      insn = INSN_MQTT;
+      str[0] = mgos_homeassistant_automation_put_str(b, dd->topic);
+      str[1] = mgos_homeassistant_automation_put_str(b, dd->payload);
+      mgos_homeassistant_automation_put(b, m, &insn, sizeof(insn));
+      mgos_homeassistant_automation_put(b, m, str, sizeof(str));
+      break;
+    }
+    case ACTION_COMMAND: {
+      struct mgos_homeassistant_automation_data_action_command *dd = d->data;
+      if (!dd->object) break;
+      insn = INSN_COMMAND;
+      ref = mgos_homeassistant_automation_put_ref(b, dd->object);
+      str[0] = mgos_homeassistant_automation_put_str(b, dd->cmd_name);
+      str[1] = mgos_homeassistant_automation_put_str(b, dd->payload);
+      mgos_homeassistant_automation_put(b, m, &insn, sizeof(insn));
+      mgos_homeassistant_automation_put(b, m, &ref, sizeof(ref));
+      mgos_homeassistant_automation_put(b, m, str, sizeof(str));
+      break;
+    }
+    case ACTION_DELAY: {
+      struct mgos_homeassistant_automation_data_action_delay *dd = d->data;
+      insn = INSN_DELAY;
+      mgos_homeassistant_automation_put(b, m, &insn, sizeof(insn));
+      mgos_homeassistant_automation_put(b, m, &dd->ms, sizeof(dd->ms));
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// Compiles the conditions and actions added to automation a into its
+// program, after the ones compiled before, and frees them. Their strings are
+// interned, and their objects resolved.
+static bool mgos_homeassistant_automation_compile(struct mgos_homeassistant_automation *a) {
+  struct mgos_homeassistant_automation_program *p = a->program, *np;
+  struct mgos_homeassistant_automation_builder b;
+  struct mgos_homeassistant_automation_data *d;
+  uint8_t insn = INSN_END;
+  size_t code_len;
+  bool ret = false;
+
+  if (p && SLIST_EMPTY(&a->conditions) && SLIST_EMPTY(&a->actions)) return true;
+
+  b.ha = a->ha;
+  b.ok = true;
+  mbuf_init(&b.refs, 0);
+  mbuf_init(&b.conditions, 0);
+  mbuf_init(&b.actions, 0);
+  mbuf_init(&b.strings, 0);
+  if (p) {
+    // What is compiled already keeps its reference indexes and string offsets.
+    const uint8_t *code = MGOS_HOMEASSISTANT_AUTOMATION_CODE(p);
+    mgos_homeassistant_automation_put(&b, &b.refs, p->refs, p->refs_len * sizeof(*p->refs));
+    mgos_homeassistant_automation_put(&b, &b.conditions, code, p->actions - 1);
+    mgos_homeassistant_automation_put(&b, &b.actions, code + p->actions, p->code_len - p->actions - 1);
+    mgos_homeassistant_automation_put(&b, &b.strings, code + p->code_len, p->strings_len);
+  }
+  SLIST_FOREACH(d, &a->conditions, entry) mgos_homeassistant_automation_put_condition(&b, d);
+  SLIST_FOREACH(d, &a->actions, entry) mgos_homeassistant_automation_put_action(&b, d);
+  mgos_homeassistant_automation_put(&b, &b.conditions, &insn, sizeof(insn));
+  mgos_homeassistant_automation_put(&b, &b.actions, &insn, sizeof(insn));
+
+  code_len = b.conditions.len + b.actions.len;
+  if (!b.ok || code_len > UINT16_MAX) {
+    LOG(LL_ERROR, ("Could not compile automation"));
+    goto exit;
+  }
+  if (!(np = malloc(sizeof(*np) + b.refs.len + code_len + b.strings.len))) goto exit;
+  np->actions = b.conditions.len;
+  np->code_len = code_len;
+  np->strings_len = b.strings.len;
+  np->refs_len = b.refs.len / sizeof(*np->refs);
+  if (b.refs.len) memcpy(np->refs, b.refs.buf, b.refs.len);
+  memcpy((uint8_t *) MGOS_HOMEASSISTANT_AUTOMATION_CODE(np), b.conditions.buf, b.conditions.len);
+  memcpy((uint8_t *) MGOS_HOMEASSISTANT_AUTOMATION_CODE(np) + np->actions, b.actions.buf, b.actions.len);
+  if (b.strings.len) memcpy((uint8_t *) MGOS_HOMEASSISTANT_AUTOMATION_CODE(np) + np->code_len, b.strings.buf, b.strings.len);
+  // Pending actions moved along with the actions.
+  if (a->next_pc && p) a->next_pc += np->actions - p->actions;
+  if (p) free(p);
+  a->program = np;
+  LOG(LL_DEBUG, ("Compiled automation: %u references, %u bytes of code, %u bytes of strings", np->refs_len, np->code_len, np->strings_len));
+
+  while (!SLIST_EMPTY(&a->conditions)) {
+    d = SLIST_FIRST(&a->conditions);
+    SLIST_REMOVE_HEAD(&a->conditions, entry);
+    mgos_homeassistant_automation_data_destroy(&d);
+  }
+  while (!SLIST_EMPTY(&a->actions)) {
+    d = SLIST_FIRST(&a->actions);
+    SLIST_REMOVE_HEAD(&a->actions, entry);
+    mgos_homeassistant_automation_data_destroy(&d);
+  }
+  ret = true;
+exit:
+  mbuf_free(&b.refs);
+  mbuf_free(&b.conditions);
+  mbuf_free(&b.actions);
+  mbuf_free(&b.strings);
+  return ret;
+}
+
+void mgos_homeassistant_automation_handler(struct mgos_homeassistant *ha, const int ev, const void *ev_data, void *user_data) {
+  struct mgos_homeassistant_object *o = (struct mgos_homeassistant_object *) ev_data;
+  struct mgos_homeassistant_automation *a;
+
+  if (!ha || !o) return;
+  if (ev != MGOS_HOMEASSISTANT_EV_OBJECT_ADD && ev != MGOS_HOMEASSISTANT_EV_OBJECT_REMOVE) return;
+  SLIST_FOREACH(a, &ha->automations, entry) {
+    struct mgos_homeassistant_automation_program *p = a->program;
+    int i;
+
+    mgos_homeassistant_automation_bind(ha, SLIST_FIRST(&a->triggers), ev, o);
+    for (i = 0; p && i < p->refs_len; i++)
+      mgos_homeassistant_automation_bind_ref(ha, &p->refs[i].o, mgos_homeassistant_automation_str(p, p->refs[i].name), ev, o);
+  }
+  (void) user_data;
+}
+
+// Parses one cron field, a comma separated list of '*', 'n' or 'n-m', each
+// optionally followed by '/step', into a bitmask of the values lo to hi.
+static bool mgos_homeassistant_automation_cron_field(const char *s, int lo, int hi, uint64_t *mask) {
+  char *end;
+
+  *mask = 0;
+  while (*s) {
+    int a, b, step = 1, i;
+    if (*s == '*') {
+      a = lo;
+      b = hi;
+      s++;
+    } else {
+      a = b = strtol(s, &end, 10);
+      if (end == s) return false;
+      s = end;
+      if (*s == '-') {
+        b = strtol(++s, &end, 10);
+        if (end == s) return false;
+        s = end;
+      }
+    }
+    if (*s == '/') {
+      step = strtol(++s, &end, 10);
+      if (end == s || step < 1) return false;
+      s = end;
+      // 'n/step' runs from n to the end of the range.
+      if (a == b) b = hi;
+    }
+    if (a < lo || b > hi || a > b) return false;
+    for (i = a; i <= b; i += step) *mask |= 1ULL << i;
+    if (*s == ',')
+      s++;
+    else if (*s)
+      return false;
+  }
+  return *mask != 0;
+}
+
+static bool mgos_homeassistant_automation_cron_parse(struct mgos_homeassistant_automation_data_time *dd, const char *spec) {
+  static const int lo[5] = {0, 0, 1, 1, 0}, hi[5] = {59, 23, 31, 12, 7};
+  uint64_t mask[5];
+  char *copy, *field, *save = NULL;
+  int i = 0;
+  bool ret = false;
+
+  if (!(copy = strdup(spec))) return false;
+  for (field = strtok_r(copy, " \t", &save); field; field = strtok_r(NULL, " \t", &save)) {
+    if (i >= 5 || !mgos_homeassistant_automation_cron_field(field, lo[i], hi[i], &mask[i])) goto exit;
+    if (i == 2) dd->any_day = field[0] == '*';
+    if (i == 4) dd->any_weekday = field[0] == '*';
+    i++;
+  }
+  if (i != 5) goto exit;
+  dd->minutes = mask[0];
+  dd->hours = mask[1];
+  dd->days = mask[2];
+  dd->months = mask[3];
+  // Both 0 and 7 are Sunday.
+  dd->weekdays = (mask[4] | mask[4] >> 7) & 0x7f;
+  ret = true;
+exit:
+  free(copy);
+  return ret;
+}
+
+static bool mgos_homeassistant_automation_cron_day(const struct mgos_homeassistant_automation_data_time *dd, const struct tm *tm) {
+  bool day = dd->days & (1UL << tm->tm_mday), weekday = dd->weekdays & (1 << tm->tm_wday);
+
+  if (!(dd->months & (1 << (tm->tm_mon + 1)))) return false;
+  // Like cron, a day matches either restricted field if both are.
+  if (dd->any_day) return weekday;
+  if (dd->any_weekday) return day;
+  return day || weekday;
+}
+
+// Returns the first minute after now that the cron trigger matches, skipping
+// days and hours that do not match as a whole, or 0 if there is none.
+static time_t mgos_homeassistant_automation_cron_next(const struct mgos_homeassistant_automation_data_time *dd, time_t now) {
+  time_t t = now - now % 60 + 60;
+  int n, m;
+
+  for (n = 0; n < 4 * 366 * 24; n++) {
+    struct tm *tm = localtime(&t);
+    if (!tm) return 0;
+    if (!mgos_homeassistant_automation_cron_day(dd, tm)) {
+      t += (23 - tm->tm_hour) * 3600 + (60 - tm->tm_min) * 60;
+      continue;
+    }
+    if (dd->hours & (1UL << tm->tm_hour)) {
+      for (m = tm->tm_min; m < 60; m++)
+        if (dd->minutes & (1ULL << m)) return t + (m - tm->tm_min) * 60;
+    }
+    t += (60 - tm->tm_min) * 60;
+  }
+  return 0;
+}
+
+static bool mgos_homeassistant_automation_fire(struct mgos_homeassistant_automation *a, void *user_data,
+                                               struct mgos_homeassistant_automation_fields *f);
+static void mgos_homeassistant_automation_step_cb(struct mgos_homeassistant_deadline *dl, void *user_data);
+static void mgos_homeassistant_automation_debounced_cb(struct mgos_homeassistant_deadline *dl, void *user_data);
+
+// Wall clock times before this are taken to mean the clock is not set yet.
+#define MGOS_HOMEASSISTANT_AUTOMATION_CLOCK_SET 1577836800
+
+// Computes the next deadline of a time trigger and schedules it.
+static void mgos_homeassistant_automation_schedule(struct mgos_homeassistant_automation_data *d) {
+  struct mgos_homeassistant_automation_data_time *dd = d->data;
+  struct mgos_homeassistant_scheduler *s = d->automation->ha ? d->automation->ha->scheduler : NULL;
+  double now = mgos_uptime(), at;
+  time_t wall;
+
+  if (!s || !dd) return;
+  if (dd->interval > 0) {
+    // Relative to the last deadline, so that intervals do not drift.
+    at = (mgos_homeassistant_deadline_pending(&dd->deadline) || dd->deadline.at == 0 ? now : dd->deadline.at) + dd->interval;
+    if (at <= now) at = now + dd->interval;
+    mgos_homeassistant_scheduler_add(s, &dd->deadline, at);
+    return;
+  }
+
+  wall = time(NULL);
+  if (wall < MGOS_HOMEASSISTANT_AUTOMATION_CLOCK_SET) {
+    dd->wall = 0;
+    mgos_homeassistant_scheduler_add(s, &dd->deadline, now + 60);
+    return;
+  }
+  // A timer that runs a little early must not find the same minute again.
+  if (wall < dd->wall) wall = dd->wall;
+  if (!(dd->wall = mgos_homeassistant_automation_cron_next(dd, wall))) {
+    LOG(LL_WARN, ("Cron trigger never matches, not scheduling it"));
+    return;
+  }
+  mgos_homeassistant_scheduler_add(s, &dd->deadline, now + (dd->wall - time(NULL)));
+}
+
+static void mgos_homeassistant_automation_unschedule(struct mgos_homeassistant_automation_data *d) {
+  struct mgos_homeassistant_automation_data_time *dd = d->data;
+
+  if ((d->type != TRIGGER_INTERVAL && d->type != TRIGGER_CRON) || !dd || !d->automation->ha) return;
+  mgos_homeassistant_scheduler_cancel(d->automation->ha->scheduler, &dd->deadline);
+}
+
+static void mgos_homeassistant_automation_time_cb(struct mgos_homeassistant_deadline *dl, void *user_data) {
+  struct mgos_homeassistant_automation_data *d = user_data;
+  struct mgos_homeassistant_automation_data_time *dd = d->data;
+  struct mgos_homeassistant_automation *a = d->automation;
+  bool due = dd->interval > 0;
+
+  // Cron deadlines are off if the clock was set or stepped since, they are
+  // computed again rather than run at the wrong time.
+  if (!due && dd->wall) {
+    time_t wall = time(NULL);
+    due = wall > dd->wall - 30 && wall < dd->wall + 30;
+  }
+  mgos_homeassistant_automation_schedule(d);
+  if (!due) return;
+  LOG(LL_DEBUG, ("Trigger: %s deadline", d->type == TRIGGER_CRON ? "cron" : "interval"));
+  mgos_homeassistant_automation_fire(a, a->ha, NULL);
+  (void) dl;
+}
+
+static struct mgos_homeassistant_automation_data_time *mgos_homeassistant_automation_data_time_create(struct json_token json, bool cron) {
+  struct mgos_homeassistant_automation_data_time *dd = calloc(1, sizeof(*dd));
+  char *spec = NULL;
+
+  if (!dd) return NULL;
+  dd->deadline.pos = -1;
+  dd->deadline.cb = mgos_homeassistant_automation_time_cb;
+  if (cron) {
+    json_scanf(json.ptr, json.len, "{cron:%Q}", &spec);
+    if (!spec || !mgos_homeassistant_automation_cron_parse(dd, spec)) goto err;
+    free(spec);
+  } else {
+    json_scanf(json.ptr, json.len, "{seconds:%lf}", &dd->interval);
+    if (dd->interval <= 0) goto err;
+  }
+  return dd;
+err:
+  if (spec) free(spec);
+  free(dd);
+  return NULL;
+}
+
+// Adds status and threshold triggers to the node's trigger index, so that
+// statuses of their object find them without trying every automation.
+static void mgos_homeassistant_automation_index_add(struct mgos_homeassistant_automation_data *d) {
+  struct mgos_homeassistant_automation_data_status *dd = d->data;
+  struct mgos_homeassistant *ha = d->automation->ha;
+  const char *name = NULL;
+
+  if (!ha || (d->type != TRIGGER_STATUS && d->type != TRIGGER_THRESHOLD)) return;
+  if (!mgos_homeassistant_automation_data_ref(d, &name) || !name) return;
+  if (d->type == TRIGGER_STATUS && !dd->status && !dd->matcher) return;
+  d->hash = mgos_homeassistant_name_hash(name, strlen(name));
+  SLIST_INSERT_HEAD(&ha->trigger_index[d->hash % MGOS_HOMEASSISTANT_INDEX_SIZE], d, index_entry);
+  d->indexed = true;
+}
+
+static void mgos_homeassistant_automation_index_remove(struct mgos_homeassistant_automation_data *d) {
+  struct mgos_homeassistant *ha = d->automation->ha;
+
+  if (!d->indexed) return;
+  SLIST_REMOVE(&ha->trigger_index[d->hash % MGOS_HOMEASSISTANT_INDEX_SIZE], d, mgos_homeassistant_automation_data, index_entry);
+  d->indexed = false;
+}
+
+// Frees data of the given type, as created for an automation data entry.
+static void mgos_homeassistant_automation_data_free(enum mgos_homeassistant_automation_datatype type, void *data) {
+  if (!data) return;
+  LOG(LL_DEBUG, ("Destroying automation data type %d", type));
+
+  switch (type) {
+    case TRIGGER_STATUS:
+    case CONDITION_STATUS:
+      mgos_homeassistant_automation_data_status_free(data);
+      return;
+    case TRIGGER_THRESHOLD:
+      mgos_homeassistant_automation_data_threshold_free(data);
+      return;
+    case TRIGGER_INTERVAL:
+    case TRIGGER_CRON:
+    case ACTION_DELAY:
+      break;
+    case ACTION_MQTT: {
+      struct mgos_homeassistant_automation_data_action_mqtt *dd = data;
+      if (dd->topic) free(dd->topic);
+      if (dd->payload) free(dd->payload);
+      break;
+    }
+    case ACTION_COMMAND: {
+      struct mgos_homeassistant_automation_data_action_command *dd = data;
+      if (dd->object) free(dd->object);
+      if (dd->payload) free(dd->payload);
+      if (dd->cmd_name) free(dd->cmd_name);
+      break;
+    }
+    default:
+      LOG(LL_WARN, ("Automation data type %d unknown, skipping .. ", type));
+  }
+  free(data);
+}
+
 bool mgos_homeassistant_automation_add_trigger(struct mgos_homeassistant_automation *a, enum mgos_homeassistant_automation_datatype type,
                                                void *data) {
   if (!a) return false;
   struct mgos_homeassistant_automation_data *d = mgos_homeassistant_automation_data_create(type, data);
   if (!d) return false;
+  d->automation = a;
   SLIST_INSERT_HEAD(&a->triggers, d, entry);
+  mgos_homeassistant_automation_index_add(d);
+  if (type == TRIGGER_INTERVAL || type == TRIGGER_CRON) {
+    ((struct mgos_homeassistant_automation_data_time *) data)->deadline.user_data = d;
+    mgos_homeassistant_automation_schedule(d);
+  }
   LOG(LL_DEBUG, ("Inserted automation trigger data type %d", type));
   return true;
 }
@@ -115,8 +987,11 @@ bool mgos_homeassistant_automation_add_condition(struct mgos_homeassistant_autom
   if (!a) return false;
   struct mgos_homeassistant_automation_data *d = mgos_homeassistant_automation_data_create(type, data);
   if (!d) return false;
+  d->automation = a;
   SLIST_INSERT_HEAD(&a->conditions, d, entry);
   LOG(LL_DEBUG, ("Inserted automation condition data type %d", type));
+  // Once created, the automation is compiled again, unless its actions run.
+  if (a->program && !a->running) mgos_homeassistant_automation_compile(a);
   return true;
 }
 
@@ -124,19 +999,45 @@ bool mgos_homeassistant_automation_add_action(struct mgos_homeassistant_automati
   if (!a) return false;
   struct mgos_homeassistant_automation_data *d = mgos_homeassistant_automation_data_create(type, data);
   if (!d) return false;
-  SLIST_INSERT_HEAD(&a->actions, d, entry);
+  d->automation = a;
+  // Actions run in the order they are added.
+  if (SLIST_EMPTY(&a->actions)) {
+    SLIST_INSERT_HEAD(&a->actions, d, entry);
+  } else {
+    struct mgos_homeassistant_automation_data *last = SLIST_FIRST(&a->actions);
+    while (SLIST_NEXT(last, entry)) last = SLIST_NEXT(last, entry);
+    SLIST_INSERT_AFTER(last, d, entry);
+  }
   LOG(LL_DEBUG, ("Inserted automation action data type %d", type));
+  if (a->program && !a->running) mgos_homeassistant_automation_compile(a);
   return true;
 }
 
-struct mgos_homeassistant_automation *mgos_homeassistant_automation_create(struct json_token json) {
+struct mgos_homeassistant_automation *mgos_homeassistant_automation_create(struct mgos_homeassistant *ha, struct json_token json) {
   struct json_token val;
   struct mgos_homeassistant_automation *a = calloc(1, sizeof(*a));
+  char *mode = NULL;
   void *h = NULL;
   int idx;
 
   if (!a) return NULL;
 
+  a->ha = ha;
+  a->step.pos = -1;
+  a->step.cb = mgos_homeassistant_automation_step_cb;
+  a->step.user_data = a;
+  a->debounced.pos = -1;
+  a->debounced.cb = mgos_homeassistant_automation_debounced_cb;
+  a->debounced.user_data = a;
+  json_scanf(json.ptr, json.len, "{mode:%Q,min_interval:%lf,debounce:%lf,max_per_minute:%hu}", &mode, &a->min_interval, &a->debounce,
+             &a->max_per_minute);
+  a->tokens = a->max_per_minute;
+  a->tokens_at = mgos_uptime();
+  if (mode && 0 == strcasecmp(mode, "cancel"))
+    a->mode = MODE_CANCEL;
+  else if (mode && 0 != strcasecmp(mode, "restart"))
+    LOG(LL_WARN, ("Unknown mode '%s', using 'restart'", mode));
+  if (mode) free(mode);
   SLIST_INIT(&a->triggers);
   SLIST_INIT(&a->conditions);
   SLIST_INIT(&a->actions);
@@ -148,12 +1049,37 @@ struct mgos_homeassistant_automation *mgos_homeassistant_automation_create(struc
       struct mgos_homeassistant_automation_data_status *dd = calloc(1, sizeof(*dd));
       if (dd) {
         json_scanf(val.ptr, val.len, "{object:%Q,status:%Q}", &dd->object, &dd->status);
-        if (!mgos_homeassistant_automation_add_trigger(a, TRIGGER_STATUS, dd)) {
+        if (!mgos_homeassistant_automation_matcher_create(val, &dd->matcher)) {
+          LOG(LL_WARN, ("Invalid trigger JSON: %.*s, skipping", (int) val.len, val.ptr));
+          mgos_homeassistant_automation_data_status_free(dd);
+        } else if (!mgos_homeassistant_automation_add_trigger(a, TRIGGER_STATUS, dd)) {
           LOG(LL_WARN, ("Could not add trigger JSON: %.*s, skipping", (int) val.len, val.ptr));
+          mgos_homeassistant_automation_data_free(TRIGGER_STATUS, dd);
         } else {
           LOG(LL_DEBUG, ("Added trigger JSON: %.*s", (int) val.len, val.ptr));
         }
       }
+    } else if (0 == strcasecmp(j_type, "threshold")) {
+      struct mgos_homeassistant_automation_data_threshold *dd = mgos_homeassistant_automation_data_threshold_create(val);
+      if (!dd) {
+        LOG(LL_WARN, ("Invalid trigger JSON: %.*s, skipping", (int) val.len, val.ptr));
+      } else if (!mgos_homeassistant_automation_add_trigger(a, TRIGGER_THRESHOLD, dd)) {
+        LOG(LL_WARN, ("Could not add trigger JSON: %.*s, skipping", (int) val.len, val.ptr));
+        mgos_homeassistant_automation_data_free(TRIGGER_THRESHOLD, dd);
+      } else {
+        LOG(LL_DEBUG, ("Added trigger JSON: %.*s", (int) val.len, val.ptr));
+      }
+    } else if (0 == strcasecmp(j_type, "interval") || 0 == strcasecmp(j_type, "cron")) {
+      bool cron = 0 == strcasecmp(j_type, "cron");
+      struct mgos_homeassistant_automation_data_time *dd = mgos_homeassistant_automation_data_time_create(val, cron);
+      if (!dd) {
+        LOG(LL_WARN, ("Invalid trigger JSON: %.*s, skipping", (int) val.len, val.ptr));
+      } else if (!mgos_homeassistant_automation_add_trigger(a, cron ? TRIGGER_CRON : TRIGGER_INTERVAL, dd)) {
+        LOG(LL_WARN, ("Could not add trigger JSON: %.*s, skipping", (int) val.len, val.ptr));
+        mgos_homeassistant_automation_data_free(cron ? TRIGGER_CRON : TRIGGER_INTERVAL, dd);
+      } else {
+        LOG(LL_DEBUG, ("Added trigger JSON: %.*s", (int) val.len, val.ptr));
+      }
     } else {
       LOG(LL_WARN, ("Unknown data type '%s', skipping ..", j_type));
     }
@@ -166,8 +1092,12 @@ struct mgos_homeassistant_automation *mgos_homeassistant_automation_create(struc
       struct mgos_homeassistant_automation_data_status *dd = calloc(1, sizeof(*dd));
       if (dd) {
         json_scanf(val.ptr, val.len, "{object:%Q,status:%Q}", &dd->object, &dd->status);
-        if (!mgos_homeassistant_automation_add_condition(a, CONDITION_STATUS, dd)) {
+        if (!mgos_homeassistant_automation_matcher_create(val, &dd->matcher)) {
+          LOG(LL_WARN, ("Invalid condition JSON: %.*s, skipping", (int) val.len, val.ptr));
+          mgos_homeassistant_automation_data_status_free(dd);
+        } else if (!mgos_homeassistant_automation_add_condition(a, CONDITION_STATUS, dd)) {
           LOG(LL_WARN, ("Could not add condition JSON: %.*s, skipping", (int) val.len, val.ptr));
+          mgos_homeassistant_automation_data_free(CONDITION_STATUS, dd);
         } else {
           LOG(LL_DEBUG, ("Added condition JSON: %.*s", (int) val.len, val.ptr));
         }
@@ -186,6 +1116,7 @@ struct mgos_homeassistant_automation *mgos_homeassistant_automation_create(struc
         json_scanf(val.ptr, val.len, "{topic:%Q,payload:%Q}", &dd->topic, &dd->payload);
         if (!mgos_homeassistant_automation_add_action(a, ACTION_MQTT, dd)) {
           LOG(LL_WARN, ("Could not add action JSON: %.*s, skipping", (int) val.len, val.ptr));
+          mgos_homeassistant_automation_data_free(ACTION_MQTT, dd);
         } else {
           LOG(LL_DEBUG, ("Added action JSON: %.*s", (int) val.len, val.ptr));
         }
@@ -196,6 +1127,20 @@ struct mgos_homeassistant_automation *mgos_homeassistant_automation_create(struc
         json_scanf(val.ptr, val.len, "{object:%Q,command:%Q,payload:%Q}", &dd->object, &dd->cmd_name, &dd->payload);
         if (!mgos_homeassistant_automation_add_action(a, ACTION_COMMAND, dd)) {
           LOG(LL_WARN, ("Could not add action JSON: %.*s, skipping", (int) val.len, val.ptr));
+          mgos_homeassistant_automation_data_free(ACTION_COMMAND, dd);
+        } else {
+          LOG(LL_DEBUG, ("Added action JSON: %.*s", (int) val.len, val.ptr));
+        }
+      }
+    } else if (0 == strcasecmp(j_type, "delay")) {
+      struct mgos_homeassistant_automation_data_action_delay *dd = calloc(1, sizeof(*dd));
+      double seconds = 0;
+      if (dd) {
+        json_scanf(val.ptr, val.len, "{ms:%u,seconds:%lf}", &dd->ms, &seconds);
+        if (seconds > 0) dd->ms = seconds * 1000;
+        if (!mgos_homeassistant_automation_add_action(a, ACTION_DELAY, dd)) {
+          LOG(LL_WARN, ("Could not add action JSON: %.*s, skipping", (int) val.len, val.ptr));
+          mgos_homeassistant_automation_data_free(ACTION_DELAY, dd);
         } else {
           LOG(LL_DEBUG, ("Added action JSON: %.*s", (int) val.len, val.ptr));
         }
@@ -206,6 +1151,10 @@ struct mgos_homeassistant_automation *mgos_homeassistant_automation_create(struc
     if (j_type) free(j_type);
   }
 
+  // Resolve objects once, so that running the automation needs no lookups.
+  if (ha) mgos_homeassistant_automation_bind(ha, SLIST_FIRST(&a->triggers), 0, NULL);
+  mgos_homeassistant_automation_compile(a);
+
   LOG(LL_DEBUG, ("Created automation"));
   return a;
 }
@@ -220,6 +1169,9 @@ static bool mgos_homeassistant_automation_run_triggers(struct mgos_homeassistant
     switch (d->type) {
       case TRIGGER_STATUS:
         if (trigger_status(user_data, trigger_data, d->data)) return true;
+        break;
+      case TRIGGER_THRESHOLD:
+        if (trigger_threshold(user_data, trigger_data, d->data)) return true;
       default:
         break;
     }
@@ -227,44 +1179,314 @@ static bool mgos_homeassistant_automation_run_triggers(struct mgos_homeassistant
   return false;
 }
 
-static bool mgos_homeassistant_automation_run_conditions(struct mgos_homeassistant_automation *a, void *user_data) {
-  struct mgos_homeassistant_automation_data *d;
-  if (!a) return true;
-  SLIST_FOREACH(d, &a->conditions, entry) {
-    switch (d->type) {
-      case CONDITION_STATUS:
-        if (!condition_status(user_data, d->data)) return false;
-      default:
+// Runs the compiled conditions of automation a, and returns true if all of
+// them hold. Conditions on objects that do not exist hold.
+static bool mgos_homeassistant_automation_run_conditions(struct mgos_homeassistant_automation *a, void *user_data,
+                                                         struct mgos_homeassistant_automation_fields *f) {
+  const struct mgos_homeassistant_automation_program *p = a ? a->program : NULL;
+  const uint8_t *pc;
+
+  (void) user_data;
+  if (!p) return true;
+  pc = MGOS_HOMEASSISTANT_AUTOMATION_CODE(p);
+  for (;;) {
+    struct mgos_homeassistant_object *o;
+    switch (*pc++) {
+      case INSN_END:
+        return true;
+      case INSN_STATUS: {
+        const char *status;
+        o = p->refs[*pc++].o;
+        status = mgos_homeassistant_automation_str(p, mgos_homeassistant_automation_get16(&pc));
+        if (o && !condition_status(o, status)) return false;
+        break;
+      }
+      case INSN_MATCH: {
+        const struct json_token *tok = NULL;
+        const char *path;
+        enum mgos_homeassistant_automation_op op;
+        double number = 0;
+        uint32_t hash;
+        uint16_t path_len;
+        bool equal = false;
+        int n;
+
+        o = p->refs[*pc++].o;
+        path = mgos_homeassistant_automation_str(p, mgos_homeassistant_automation_get16(&pc));
+        hash = mgos_homeassistant_automation_get32(&pc);
+        path_len = mgos_homeassistant_automation_get16(&pc);
+        op = *pc++;
+        if (o) tok = mgos_homeassistant_automation_fields_find(mgos_homeassistant_automation_fields_get(f, o), hash, path_len);
+        if (op == OP_LT || op == OP_GT) {
+          number = mgos_homeassistant_automation_get_double(&pc);
+        } else {
+          for (n = *pc++; n > 0; n--) {
+            const char *value = mgos_homeassistant_automation_str(p, mgos_homeassistant_automation_get16(&pc));
+            if (tok && !equal) equal = mgos_homeassistant_automation_value_eq(value, tok);
+          }
+        }
+        if (!o) break;
+        equal = mgos_homeassistant_automation_compare(tok, op, number, equal);
+        LOG(LL_DEBUG, ("Condition: Object('%s') path '%s' %smatches", o->object_name, path, equal ? "" : "no "));
+        if (!equal) return false;
         break;
+      }
+      default:
+        LOG(LL_ERROR, ("Invalid condition instruction %u", pc[-1]));
+        return false;
     }
   }
-  return true;
 }
 
-static bool mgos_homeassistant_automation_run_actions(struct mgos_homeassistant_automation *a, void *user_data) {
-  struct mgos_homeassistant_automation_data *d;
-  if (!a) return false;
-  if (SLIST_EMPTY(&a->actions)) return false;
-  SLIST_FOREACH(d, &a->actions, entry) {
-    switch (d->type) {
-      case ACTION_MQTT:
-        action_mqtt(d->data);
+// Runs the compiled actions of automation a from offset pc on, up to a delay
+// action, which schedules the actions after it.
+static void mgos_homeassistant_automation_run_program(struct mgos_homeassistant_automation *a, uint16_t start) {
+  const struct mgos_homeassistant_automation_program *p = a->program;
+  const uint8_t *code, *pc;
+
+  if (!p) return;
+  code = MGOS_HOMEASSISTANT_AUTOMATION_CODE(p);
+  pc = code + start;
+  for (;;) {
+    switch (*pc++) {
+      case INSN_END:
+        return;
+      case INSN_MQTT: {
+        const char *topic = mgos_homeassistant_automation_str(p, mgos_homeassistant_automation_get16(&pc));
+        action_mqtt(topic, mgos_homeassistant_automation_str(p, mgos_homeassistant_automation_get16(&pc)));
         break;
-      case ACTION_COMMAND:
-        action_command(user_data, d->data);
+      }
+      case INSN_COMMAND: {
+        const struct mgos_homeassistant_automation_ref *ref = &p->refs[*pc++];
+        const char *cmd_name = mgos_homeassistant_automation_str(p, mgos_homeassistant_automation_get16(&pc));
+        const char *payload = mgos_homeassistant_automation_str(p, mgos_homeassistant_automation_get16(&pc));
+        action_command(ref->o, mgos_homeassistant_automation_str(p, ref->name), cmd_name, payload);
         break;
+      }
+      case INSN_DELAY: {
+        uint32_t ms = mgos_homeassistant_automation_get32(&pc);
+        if (*pc == INSN_END) return;
+        a->next_pc = pc - code;
+        if (!mgos_homeassistant_scheduler_add(a->ha ? a->ha->scheduler : NULL, &a->step, mgos_uptime() + ms / 1000.0)) {
+          LOG(LL_ERROR, ("Could not schedule actions after a delay of %u ms", (unsigned) ms));
+          a->next_pc = 0;
+        }
+        return;
+      }
       default:
-        break;
+        LOG(LL_ERROR, ("Invalid action instruction %u", pc[-1]));
+        return;
     }
   }
+}
+
+// Runs the actions of automation a from offset pc on. Actions may add
+// conditions or actions to it, which are compiled once they are done, as the
+// program must not be freed while they run.
+static void mgos_homeassistant_automation_run_actions(struct mgos_homeassistant_automation *a, uint16_t start) {
+  a->running++;
+  mgos_homeassistant_automation_run_program(a, start);
+  if (--a->running == 0) mgos_homeassistant_automation_compile(a);
+}
+
+static void mgos_homeassistant_automation_step_cb(struct mgos_homeassistant_deadline *dl, void *user_data) {
+  struct mgos_homeassistant_automation *a = user_data;
+  uint16_t pc = a->next_pc;
+
+  a->next_pc = 0;
+  if (pc) mgos_homeassistant_automation_run_actions(a, pc);
+  (void) dl;
+}
+
+static void mgos_homeassistant_automation_act(struct mgos_homeassistant_automation *a) {
+  const struct mgos_homeassistant_automation_program *p = a->program;
+
+  if (mgos_homeassistant_deadline_pending(&a->step)) {
+    mgos_homeassistant_scheduler_cancel(a->ha->scheduler, &a->step);
+    a->next_pc = 0;
+    if (a->mode == MODE_CANCEL) {
+      LOG(LL_DEBUG, ("Cancelled pending actions"));
+      return;
+    }
+  }
+  if (!p || MGOS_HOMEASSISTANT_AUTOMATION_CODE(p)[p->actions] == INSN_END) return;
+  mgos_homeassistant_automation_run_actions(a, p->actions);
+  mgos_homeassistant_call_handlers(a->ha, MGOS_HOMEASSISTANT_EV_AUTOMATION_RUN, a);
+}
+
+static void mgos_homeassistant_automation_queue_cb(void *arg) {
+  struct mgos_homeassistant_automation_queue *q = arg;
+  int n = 0;
+
+  q->timer = MGOS_INVALID_TIMER_ID;
+  while (q->len > 0 && (q->runs_per_tick <= 0 || n < q->runs_per_tick)) {
+    struct mgos_homeassistant_automation_queue_entry e = q->entries[q->head];
+    q->head = (q->head + 1) % q->size;
+    q->len--;
+    if (!e.a) continue;
+    q->depth = e.depth + 1;
+    q->stats.runs++;
+    mgos_homeassistant_automation_act(e.a);
+    n++;
+  }
+  q->depth = 0;
+  q->stats.len = q->len;
+  if (q->len > 0 && q->timer == MGOS_INVALID_TIMER_ID) q->timer = mgos_set_timer(0, 0, mgos_homeassistant_automation_queue_cb, q);
+}
+
+// Queues the actions of automation a, or runs them right away if the node has
+// no queue.
+static bool mgos_homeassistant_automation_enqueue(struct mgos_homeassistant_automation *a) {
+  struct mgos_homeassistant_automation_queue *q = a->ha ? a->ha->automation_queue : NULL;
+
+  if (!q) {
+    mgos_homeassistant_automation_act(a);
+    return true;
+  }
+  if (q->depth > q->max_depth) {
+    q->stats.dropped_depth++;
+    LOG(LL_WARN, ("Dropping automation run %u automations deep, is there a cycle?", q->depth));
+    return false;
+  }
+  if (q->len == q->size) {
+    q->stats.dropped_full++;
+    LOG(LL_WARN, ("Dropping automation run, %u runs queued already", q->len));
+    return false;
+  }
+  q->entries[(q->head + q->len) % q->size].a = a;
+  q->entries[(q->head + q->len) % q->size].depth = q->depth;
+  q->len++;
+  q->stats.queued++;
+  q->stats.len = q->len;
+  if (q->len > q->stats.max_len) q->stats.max_len = q->len;
+  if (q->timer == MGOS_INVALID_TIMER_ID) q->timer = mgos_set_timer(0, 0, mgos_homeassistant_automation_queue_cb, q);
+  return true;
+}
+
+// Forgets the queued runs of automation a, as it is destroyed.
+static void mgos_homeassistant_automation_dequeue(struct mgos_homeassistant_automation *a) {
+  struct mgos_homeassistant_automation_queue *q = a->ha ? a->ha->automation_queue : NULL;
+  int i;
+
+  if (!q) return;
+  for (i = 0; i < q->len; i++)
+    if (q->entries[(q->head + i) % q->size].a == a) q->entries[(q->head + i) % q->size].a = NULL;
+}
+
+struct mgos_homeassistant_automation_queue *mgos_homeassistant_automation_queue_create(int size, int runs_per_tick, int max_depth) {
+  struct mgos_homeassistant_automation_queue *q;
+
+  if (size <= 0 || size > UINT16_MAX) return NULL;
+  if (!(q = calloc(1, sizeof(*q)))) return NULL;
+  if (!(q->entries = calloc(size, sizeof(*q->entries)))) {
+    free(q);
+    return NULL;
+  }
+  q->size = size;
+  q->timer = MGOS_INVALID_TIMER_ID;
+  q->runs_per_tick = runs_per_tick;
+  q->max_depth = max_depth < 0 ? 0 : max_depth > UINT8_MAX - 1 ? UINT8_MAX - 1 : max_depth;
+  return q;
+}
+
+bool mgos_homeassistant_automation_queue_get_stats(struct mgos_homeassistant *ha, struct mgos_homeassistant_automation_queue_stats *stats) {
+  if (!ha || !stats) return false;
+  if (!ha->automation_queue) {
+    memset(stats, 0, sizeof(*stats));
+    return true;
+  }
+  *stats = ha->automation_queue->stats;
+  return true;
+}
+
+// Returns whether min_interval and max_per_minute allow automation a to run
+// now, and takes the run from them if so.
+static bool mgos_homeassistant_automation_allow(struct mgos_homeassistant_automation *a) {
+  double now = mgos_uptime();
+
+  if (a->min_interval > 0 && a->fired > 0 && now - a->last_run < a->min_interval) return false;
+  if (a->max_per_minute > 0) {
+    a->tokens += (now - a->tokens_at) * a->max_per_minute / 60.0;
+    if (a->tokens > a->max_per_minute) a->tokens = a->max_per_minute;
+    a->tokens_at = now;
+    if (a->tokens < 1) return false;
+    a->tokens -= 1;
+  }
+  a->last_run = now;
   return true;
 }
 
+static bool mgos_homeassistant_automation_fire_now(struct mgos_homeassistant_automation *a, void *user_data,
+                                                   struct mgos_homeassistant_automation_fields *f) {
+  if (!mgos_homeassistant_automation_run_conditions(a, user_data, f)) return false;
+  if (!mgos_homeassistant_automation_allow(a)) {
+    a->suppressed++;
+    LOG(LL_DEBUG, ("Automation rate limited, %u runs suppressed", (unsigned) a->suppressed));
+    return false;
+  }
+  a->fired++;
+  return mgos_homeassistant_automation_enqueue(a);
+}
+
+static void mgos_homeassistant_automation_debounced_cb(struct mgos_homeassistant_deadline *dl, void *user_data) {
+  struct mgos_homeassistant_automation *a = user_data;
+
+  mgos_homeassistant_automation_fire_now(a, a->ha, NULL);
+  (void) dl;
+}
+
+// Runs the automation whose trigger fired: its actions are queued if all of
+// its conditions hold and its rate limits allow. Conditions on the object
+// whose status are parsed in f use those fields. With a debounce, the
+// automation runs once its triggers have been quiet for that long, and its
+// conditions are evaluated then.
+static bool mgos_homeassistant_automation_fire(struct mgos_homeassistant_automation *a, void *user_data,
+                                               struct mgos_homeassistant_automation_fields *f) {
+  if (a->debounce > 0 && a->ha) {
+    if (mgos_homeassistant_deadline_pending(&a->debounced)) a->suppressed++;
+    return mgos_homeassistant_scheduler_add(a->ha->scheduler, &a->debounced, mgos_uptime() + a->debounce);
+  }
+  return mgos_homeassistant_automation_fire_now(a, user_data, f);
+}
+
 bool mgos_homeassistant_automation_run(struct mgos_homeassistant_automation *a, enum mgos_homeassistant_automation_datatype trigger_type,
                                        void *trigger_data, void *user_data) {
   if (!mgos_homeassistant_automation_run_triggers(a, trigger_type, trigger_data, user_data)) return false;
-  if (!mgos_homeassistant_automation_run_conditions(a, user_data)) return false;
-  if (mgos_homeassistant_automation_run_actions(a, user_data)) mgos_homeassistant_call_handlers(user_data, MGOS_HOMEASSISTANT_EV_AUTOMATION_RUN, a);
+  return mgos_homeassistant_automation_fire(a, user_data, NULL);
+}
+
+bool mgos_homeassistant_automation_run_status(struct mgos_homeassistant *ha, struct mgos_homeassistant_object *o) {
+  static uint32_t s_event = 0;
+  struct mgos_homeassistant_automation_data *d;
+  struct mgos_homeassistant_automation_fields f;
+  uint32_t hash, event;
+
+  if (!ha || !o) return false;
+  hash = mgos_homeassistant_name_hash(o->object_name, strlen(o->object_name));
+  // Automations with several triggers on this object run at most once per status.
+  event = ++s_event;
+  // The status is parsed once, when the first matcher needs it.
+  f.o = NULL;
+
+  SLIST_FOREACH(d, &ha->trigger_index[hash % MGOS_HOMEASSISTANT_INDEX_SIZE], index_entry) {
+    struct mgos_homeassistant_automation *a = d->automation;
+    const char *name = NULL;
+    bool match;
+
+    if (d->hash != hash) continue;
+    mgos_homeassistant_automation_data_ref(d, &name);
+    if (!name || 0 != strcasecmp(name, o->object_name)) continue;
+    // Thresholds follow every status, to keep their edge state current.
+    if (d->type == TRIGGER_THRESHOLD)
+      match = trigger_threshold_match(o, d->data, &f);
+    else
+      match = a->event != event && trigger_status_match(o, d->data, &f);
+    if (!match || a->event == event) continue;
+    a->event = event;
+    mgos_homeassistant_automation_fire(a, ha, &f);
+    // Actions may have changed the status, parse it again if needed.
+    f.o = NULL;
+  }
   return true;
 }
 
@@ -279,36 +1501,9 @@ struct mgos_homeassistant_automation_data *mgos_homeassistant_automation_data_cr
 
 bool mgos_homeassistant_automation_data_destroy(struct mgos_homeassistant_automation_data **d) {
   if (!(*d)) return false;
-  if (!(*d)->data) return true;
-  LOG(LL_DEBUG, ("Destroying automation data type %d", (*d)->type));
-
-  switch ((*d)->type) {
-    case TRIGGER_STATUS:
-    case CONDITION_STATUS: {
-      struct mgos_homeassistant_automation_data_status *dd = (*d)->data;
-      if (!dd) return true;
-      if (dd->object) free(dd->object);
-      if (dd->status) free(dd->status);
-      break;
-    }
-    case ACTION_MQTT: {
-      struct mgos_homeassistant_automation_data_action_mqtt *dd = (*d)->data;
-      if (!dd) return true;
-      if (dd->topic) free(dd->topic);
-      if (dd->payload) free(dd->payload);
-      break;
-    }
-    case ACTION_COMMAND: {
-      struct mgos_homeassistant_automation_data_action_command *dd = (*d)->data;
-      if (!dd) return true;
-      if (dd->object) free(dd->object);
-      if (dd->payload) free(dd->payload);
-      if (dd->cmd_name) free(dd->cmd_name);
-      break;
-    }
-    default:
-      LOG(LL_WARN, ("Automation data type %d unknown, skipping .. ", (*d)->type));
-  }
+  mgos_homeassistant_automation_data_free((*d)->type, (*d)->data);
+  free(*d);
+  *d = NULL;
   return true;
 }
 
@@ -316,22 +1511,34 @@ bool mgos_homeassistant_automation_destroy(struct mgos_homeassistant_automation
   if (!(*a)) return false;
   LOG(LL_DEBUG, ("Destroying automation"));
 
+  mgos_homeassistant_automation_dequeue(*a);
+  if ((*a)->ha) {
+    mgos_homeassistant_scheduler_cancel((*a)->ha->scheduler, &(*a)->step);
+    mgos_homeassistant_scheduler_cancel((*a)->ha->scheduler, &(*a)->debounced);
+  }
   while (!SLIST_EMPTY(&(*a)->triggers)) {
     struct mgos_homeassistant_automation_data *d;
     d = SLIST_FIRST(&(*a)->triggers);
+    SLIST_REMOVE_HEAD(&(*a)->triggers, entry);
+    mgos_homeassistant_automation_index_remove(d);
+    mgos_homeassistant_automation_unschedule(d);
     mgos_homeassistant_automation_data_destroy(&d);
   }
   while (!SLIST_EMPTY(&(*a)->conditions)) {
     struct mgos_homeassistant_automation_data *d;
     d = SLIST_FIRST(&(*a)->conditions);
+    SLIST_REMOVE_HEAD(&(*a)->conditions, entry);
     mgos_homeassistant_automation_data_destroy(&d);
   }
   while (!SLIST_EMPTY(&(*a)->actions)) {
     struct mgos_homeassistant_automation_data *d;
     d = SLIST_FIRST(&(*a)->actions);
+    SLIST_REMOVE_HEAD(&(*a)->actions, entry);
     mgos_homeassistant_automation_data_destroy(&d);
   }
 
+  if ((*a)->program) free((*a)->program);
+
   free(*a);
   *a = NULL;
   return true;
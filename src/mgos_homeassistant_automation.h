@@ -16,30 +16,88 @@
 
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "common/queue.h"
 #include "frozen/frozen.h"
+#include "mgos_homeassistant_scheduler.h"
 #include "mongoose.h"
 
+struct mgos_homeassistant;
+struct mgos_homeassistant_object;
 struct mgos_homeassistant_automation;
 struct mgos_homeassistant_automation_data;
 
 enum mgos_homeassistant_automation_datatype {
   TRIGGER_NONE = 0,
   TRIGGER_STATUS = 1,
+  TRIGGER_THRESHOLD = 2,
+  TRIGGER_INTERVAL = 3,
+  TRIGGER_CRON = 4,
 
   CONDITION_NONE = 100,
   CONDITION_STATUS = 101,
 
   ACTION_NONE = 200,
   ACTION_MQTT = 201,
-  ACTION_COMMAND = 202
+  ACTION_COMMAND = 202,
+  ACTION_DELAY = 203
+};
+
+// What a trigger does to an automation whose actions are waiting for a delay.
+enum mgos_homeassistant_automation_mode {
+  MODE_RESTART = 0,  // cancel the pending actions and run all actions again
+  MODE_CANCEL = 1    // cancel the pending actions only
+};
+
+struct mgos_homeassistant_automation_ref {
+  struct mgos_homeassistant_object *o;  // resolved object, NULL while it does not exist
+  uint16_t name;                        // offset of the object name in the strings
+};
+
+// The conditions and actions of an automation, compiled into one block: the
+// object references, followed by code_len bytes of code and strings_len bytes
+// of NUL terminated strings that the code refers to by offset. Conditions run
+// from offset 0 and actions from offset actions, each up to an end
+// instruction.
+struct mgos_homeassistant_automation_program {
+  uint16_t actions;
+  uint16_t code_len;
+  uint16_t strings_len;
+  uint8_t refs_len;
+  struct mgos_homeassistant_automation_ref refs[];
 };
 
 struct mgos_homeassistant_automation {
+  struct mgos_homeassistant *ha;
+  uint32_t event;  // last status event this automation was triggered by
+  enum mgos_homeassistant_automation_mode mode;  // "mode" of the JSON description, restart unless set to cancel
+
+  // Actions after a delay action wait in the node's scheduler.
+  struct mgos_homeassistant_deadline step;
+  uint16_t next_pc;  // offset of the actions after a pending delay, 0 if none
+
+  // Rate limits: "min_interval" seconds between runs, a "debounce" of seconds
+  // without triggers before running and at most "max_per_minute" runs.
+  double min_interval;
+  double debounce;
+  uint16_t max_per_minute;
+  double last_run;
+  double tokens;  // runs left in the max_per_minute bucket, at tokens_at
+  double tokens_at;
+  struct mgos_homeassistant_deadline debounced;
+  uint32_t fired;       // runs that passed their conditions and the rate limits
+  uint32_t suppressed;  // runs held back by the rate limits or superseded while debouncing
+
   SLIST_HEAD(triggers, mgos_homeassistant_automation_data) triggers;
+  // Conditions and actions added since the automation was last compiled into
+  // its program, which happens once it is created and as they are added after
+  // that, or once its actions are done running if they are added meanwhile.
   SLIST_HEAD(conditions, mgos_homeassistant_automation_data) conditions;
   SLIST_HEAD(actions, mgos_homeassistant_automation_data) actions;
+  struct mgos_homeassistant_automation_program *program;
+  uint8_t running;  // nesting depth of the runs of its actions, which use the program
 
   SLIST_ENTRY(mgos_homeassistant_automation) entry;
 };
@@ -47,13 +105,75 @@ struct mgos_homeassistant_automation {
 struct mgos_homeassistant_automation_data {
   enum mgos_homeassistant_automation_datatype type;
   void *data;
+  struct mgos_homeassistant_automation *automation;
 
   SLIST_ENTRY(mgos_homeassistant_automation_data) entry;
+  // TRIGGER_STATUS data is also kept in the node's trigger index, by the name
+  // hash of its object.
+  uint32_t hash;
+  bool indexed;
+  SLIST_ENTRY(mgos_homeassistant_automation_data) index_entry;
+};
+
+enum mgos_homeassistant_automation_op { OP_NONE = 0, OP_EQ, OP_NE, OP_IN, OP_LT, OP_GT };
+
+// A field matcher, compiled once from a status trigger or condition such as
+// {"object": "si7021", "path": "temperature", "op": "gt", "value": 25}. The
+// values of eq, ne and in are kept as text and compare numerically against
+// numbers; lt and gt compare against number.
+struct mgos_homeassistant_automation_matcher {
+  char *path;  // frozen path, eg. '.temperature'
+  uint32_t hash;
+  uint16_t path_len;
+  enum mgos_homeassistant_automation_op op;
+  double number;
+  int values_len;
+  char **values;
 };
 
 struct mgos_homeassistant_automation_data_status {
   char *object;
-  char *status;
+  char *status;  // substring of the status, used if there is no matcher
+  struct mgos_homeassistant_automation_matcher *matcher;
+  struct mgos_homeassistant_object *o;  // resolved object, NULL while it does not exist
+};
+
+// A numeric threshold on a field of an object status, such as
+// {"type": "threshold", "object": "si7021_0", "path": "temperature", "above": 25,
+// "hysteresis": 0.5, "dwell": 30}. It fires once when the value crosses the
+// threshold and stays beyond it for dwell seconds, as seen by its statuses,
+// and rearms once the value is back beyond the hysteresis band.
+struct mgos_homeassistant_automation_data_threshold {
+  char *object;
+  char *path;  // frozen path, eg. '.temperature'
+  uint32_t hash;
+  uint16_t path_len;
+  bool above;  // fire when rising above threshold, rather than dropping below it
+  double threshold;
+  double hysteresis;
+  double dwell;
+  struct mgos_homeassistant_object *o;  // resolved object, NULL while it does not exist
+
+  // Edge state
+  bool fired;    // crossed and fired, waiting to rearm
+  double since;  // uptime the value went beyond the threshold, 0 if it is not
+};
+
+// An interval trigger {"type": "interval", "seconds": 300}, or a cron trigger
+// {"type": "cron", "cron": "*/15 6-22 * * 1-5"} with minute, hour, day of
+// month, month and day of week fields in local time. Their next deadline is
+// computed and kept in the node's scheduler, so they need no polling.
+struct mgos_homeassistant_automation_data_time {
+  double interval;  // seconds, 0 for cron
+  uint64_t minutes;
+  uint32_t hours;
+  uint32_t days;     // day of month 1-31
+  uint16_t months;   // 1-12
+  uint8_t weekdays;  // 0-6, Sunday is 0
+  bool any_day;      // day of month is '*'
+  bool any_weekday;  // day of week is '*'
+  time_t wall;       // wall clock time of the cron deadline, 0 while the clock is not set
+  struct mgos_homeassistant_deadline deadline;
 };
 
 struct mgos_homeassistant_automation_data_action_mqtt {
@@ -61,13 +181,53 @@ struct mgos_homeassistant_automation_data_action_mqtt {
   char *payload;
 };
 
+// Waits before running the next actions, {"type": "delay", "ms": 500}.
+struct mgos_homeassistant_automation_data_action_delay {
+  uint32_t ms;
+};
+
 struct mgos_homeassistant_automation_data_action_command {
   char *object;
   char *cmd_name;
   char *payload;
 };
 
-struct mgos_homeassistant_automation *mgos_homeassistant_automation_create(struct json_token val);
+struct mgos_homeassistant_automation_queue_stats {
+  uint32_t queued;         // runs queued
+  uint32_t runs;           // runs taken from the queue
+  uint32_t dropped_full;   // runs dropped because the queue was full
+  uint32_t dropped_depth;  // runs dropped because they were chained too deep
+  uint16_t len;            // runs in the queue
+  uint16_t max_len;        // most runs ever in the queue
+};
+
+struct mgos_homeassistant_automation_queue_entry {
+  struct mgos_homeassistant_automation *a;  // NULL once a is destroyed
+  uint8_t depth;                            // automation runs that led to this one
+};
+
+// Automations whose triggers fire and conditions hold are queued, and their
+// actions run from the main loop, runs_per_tick at a time. Actions that
+// trigger automations queue them rather than run them on the same stack, one
+// level deeper, so that a cycle ends at max_depth.
+struct mgos_homeassistant_automation_queue {
+  struct mgos_homeassistant_automation_queue_entry *entries;
+  uint16_t size;
+  uint16_t head;
+  uint16_t len;
+  uint8_t depth;  // depth of runs queued now: one more than the run being taken, 0 outside of it
+  uint8_t max_depth;
+  int runs_per_tick;
+  mgos_timer_id timer;
+  struct mgos_homeassistant_automation_queue_stats stats;
+};
+
+struct mgos_homeassistant_automation_queue *mgos_homeassistant_automation_queue_create(int size, int runs_per_tick, int max_depth);
+bool mgos_homeassistant_automation_queue_get_stats(struct mgos_homeassistant *ha, struct mgos_homeassistant_automation_queue_stats *stats);
+
+// Creates an automation from its JSON description, and adds its status
+// triggers to the trigger index of node ha.
+struct mgos_homeassistant_automation *mgos_homeassistant_automation_create(struct mgos_homeassistant *ha, struct json_token val);
 
 bool mgos_homeassistant_automation_add_trigger(struct mgos_homeassistant_automation *a, enum mgos_homeassistant_automation_datatype type, void *data);
 bool mgos_homeassistant_automation_add_condition(struct mgos_homeassistant_automation *a, enum mgos_homeassistant_automation_datatype type,
@@ -78,9 +238,9 @@ struct mgos_homeassistant_automation_data *mgos_homeassistant_automation_data_cr
 bool mgos_homeassistant_automation_data_destroy(struct mgos_homeassistant_automation_data **d);
 
 // Note: automation_type is the automation that should trigger (MUST be
-// TRIGGER_*) and its accompanying data. Usually, this will be a struct
-// mgos_homeassistant_automation_data_status *; although later trigger
-// automations such as TRIGGER_CRON Typical call site:
+// TRIGGER_*) and its accompanying data, a struct
+// mgos_homeassistant_automation_data_status *. Time based triggers such as
+// TRIGGER_CRON run from the node's scheduler instead. Typical call site:
 //
 // mgos_homeassistant_automation_data_status s;
 // s.object = "button";
@@ -90,4 +250,12 @@ bool mgos_homeassistant_automation_data_destroy(struct mgos_homeassistant_automa
 bool mgos_homeassistant_automation_run(struct mgos_homeassistant_automation *a, enum mgos_homeassistant_automation_datatype trigger_type,
                                        void *trigger_data, void *user_data);
 
+// Runs the automations that have a status trigger on object o, as found in the
+// node's trigger index, rather than trying every automation of the node.
+bool mgos_homeassistant_automation_run_status(struct mgos_homeassistant *ha, struct mgos_homeassistant_object *o);
+
 bool mgos_homeassistant_automation_destroy(struct mgos_homeassistant_automation **a);
+
+// Keeps the resolved objects of all automations of the node current. Register
+// for MGOS_HOMEASSISTANT_EVM_OBJECT_ADD and MGOS_HOMEASSISTANT_EVM_OBJECT_REMOVE.
+void mgos_homeassistant_automation_handler(struct mgos_homeassistant *ha, const int ev, const void *ev_data, void *user_data);
@@ -121,19 +121,19 @@ bool mgos_homeassistant_barometer_fromjson(struct mgos_homeassistant *ha, struct
 
   float value = NAN;
   if (mgos_barometer_get_humidity(d->dev, &value)) {
-    if (!mgos_homeassistant_object_class_add(o, "humidity", "\"unit_of_measurement\":\"%\"", barometer_stat_humidity)) {
+    if (!mgos_homeassistant_object_class_add_static(o, "humidity", "\"unit_of_measurement\":\"%\"", barometer_stat_humidity)) {
       LOG(LL_ERROR, ("Could not add 'humidity' class to object %s", nameptr));
       goto exit;
     }
   }
   if (mgos_barometer_get_temperature(d->dev, &value)) {
-    if (!mgos_homeassistant_object_class_add(o, "temperature", "\"unit_of_measurement\":\"°C\"", barometer_stat_temperature)) {
+    if (!mgos_homeassistant_object_class_add_static(o, "temperature", "\"unit_of_measurement\":\"°C\"", barometer_stat_temperature)) {
       LOG(LL_ERROR, ("Could not add 'temperature' class to object %s", nameptr));
       goto exit;
     }
   }
   if (mgos_barometer_get_pressure(d->dev, &value)) {
-    if (!mgos_homeassistant_object_class_add(o, "pressure", "\"unit_of_measurement\":\"hPa\"", barometer_stat_pressure)) {
+    if (!mgos_homeassistant_object_class_add_static(o, "pressure", "\"unit_of_measurement\":\"hPa\"", barometer_stat_pressure)) {
       LOG(LL_ERROR, ("Could not add 'pressure' class to object %s", nameptr));
       goto exit;
     }
@@ -88,7 +88,7 @@ bool mgos_homeassistant_bh1750_fromjson(struct mgos_homeassistant *ha, struct js
   o->pre_remove_cb = bh1750_pre_remove_cb;
 
   // if (!mgos_homeassistant_object_class_add(o, "illuminance", "\"unit_of_measurement\":\"lx\"", bh1750_stat_light)) {
-  if (!mgos_homeassistant_object_class_add(o, "illuminance", "\"unit_of_measurement\":\"lx\"", bh1750_stat_light)) {
+  if (!mgos_homeassistant_object_class_add_static(o, "illuminance", "\"unit_of_measurement\":\"lx\"", bh1750_stat_light)) {
     LOG(LL_ERROR, ("Could not add 'illuminance' class to object %s", nameptr));
     goto exit;
   }
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos_homeassistant_diagnostics.h"
+
+#include "mgos.h"
+#include "mgos_homeassistant_automation.h"
+
+static void diagnostics_timer(void *user_data) {
+  struct mgos_homeassistant_object *o = (struct mgos_homeassistant_object *) user_data;
+  if (!o) return;
+  mgos_homeassistant_object_send_status(o);
+}
+
+static void diagnostics_stat(struct mgos_homeassistant_object *o, struct json_out *json) {
+  struct mgos_homeassistant_object *obj, *slowest = NULL;
+  struct mgos_homeassistant_arena_stats arena;
+  struct mgos_homeassistant_automation_queue_stats queue;
+  uint32_t objects = 0, slowest_us = 0;
+
+  if (!o || !json) return;
+
+  SLIST_FOREACH(obj, &o->ha->objects, entry) {
+    struct mgos_homeassistant_object_class *c;
+    uint32_t us = obj->stats.cb_us_max;
+
+    objects++;
+    if (obj == o) continue;
+    SLIST_FOREACH(c, &obj->classes, entry) {
+      if (c->stats.cb_us_max > us) us = c->stats.cb_us_max;
+    }
+    if (!slowest || us > slowest_us) {
+      slowest = obj;
+      slowest_us = us;
+    }
+  }
+  mgos_homeassistant_arena_stats(o->ha, &arena);
+  mgos_homeassistant_automation_queue_get_stats(o->ha, &queue);
+
+  json_printf(json, "objects:%u,msgs:%u,bytes:%u,slowest:%Q,slowest_us:%u,arena_used:%lu,free_ram:%lu", (unsigned) objects,
+              (unsigned) o->ha->pub_msgs, (unsigned) o->ha->pub_bytes, slowest ? slowest->object_name : NULL, (unsigned) slowest_us,
+              (unsigned long) arena.used, (unsigned long) mgos_get_free_heap_size());
+  json_printf(json, ",automation_queue_max:%u,automation_dropped:%u", (unsigned) queue.max_len,
+              (unsigned) (queue.dropped_full + queue.dropped_depth));
+}
+
+static void diagnostics_pre_remove_cb(struct mgos_homeassistant_object *o) {
+  struct mgos_homeassistant_diagnostics *d = NULL;
+  if (!o) return;
+  if (!(d = (struct mgos_homeassistant_diagnostics *) o->user_data)) return;
+  mgos_clear_timer(d->timer);
+  free(o->user_data);
+  o->user_data = NULL;
+}
+
+bool mgos_homeassistant_diagnostics_add(struct mgos_homeassistant *ha) {
+  const char *name = mgos_sys_config_get_homeassistant_diagnostics_name();
+  int period = mgos_sys_config_get_homeassistant_diagnostics_period();
+  struct mgos_homeassistant_object *o = NULL;
+  struct mgos_homeassistant_diagnostics *d = NULL;
+  bool ret = false;
+
+  if (!ha || !name) goto exit;
+  if (mgos_homeassistant_object_get_exact(ha, name)) return true;
+  if (!(d = calloc(1, sizeof(*d)))) goto exit;
+
+  o = mgos_homeassistant_object_add_static(ha, name, COMPONENT_SENSOR,
+                                           "\"value_template\":\"{{ value_json.slowest_us }}\",\"unit_of_measurement\":\"us\"",
+                                           diagnostics_stat, d);
+  if (!o) {
+    LOG(LL_ERROR, ("Could not add object %s to homeassistant", name));
+    goto exit;
+  }
+  o->pre_remove_cb = diagnostics_pre_remove_cb;
+
+  if (period > 0) d->timer = mgos_set_timer(period * 1000, true, diagnostics_timer, o);
+
+  ret = true;
+  LOG(LL_DEBUG, ("Successfully created object %s", name));
+exit:
+  if (!ret && d) free(d);
+  return ret;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "mgos_homeassistant.h"
+
+struct mgos_homeassistant_diagnostics {
+  mgos_timer_id timer;
+};
+
+// Adds a sensor object to the node that reports the node's publish counters,
+// arena usage and the object with the slowest status callback, unless an
+// object with homeassistant.diagnostics.name already exists.
+bool mgos_homeassistant_diagnostics_add(struct mgos_homeassistant *ha);
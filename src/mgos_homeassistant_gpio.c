@@ -109,10 +109,10 @@ static bool mgos_homeassistant_gpio_motion_fromjson(struct mgos_homeassistant *h
   } else {
     pull = j_invert ? MGOS_GPIO_PULL_UP : MGOS_GPIO_PULL_DOWN;
   }
-  if (!(o = mgos_homeassistant_object_add(ha, object_name, COMPONENT_BINARY_SENSOR,
-                                          "\"payload_on\":true,\"payload_off\":false,\"value_template\":\"{{ "
-                                          "value_json.motion }}\",\"device_class\":\"motion\"",
-                                          motion_stat, user_data)))
+  if (!(o = mgos_homeassistant_object_add_static(ha, object_name, COMPONENT_BINARY_SENSOR,
+                                                 "\"payload_on\":true,\"payload_off\":false,\"value_template\":\"{{ "
+                                                 "value_json.motion }}\",\"device_class\":\"motion\"",
+                                                 motion_stat, user_data)))
     goto exit;
   o->pre_remove_cb = motion_pre_remove_cb;
 
@@ -153,9 +153,10 @@ static void momentary_timer_cb(void *user_data) {
   if (!d) return;
 
   if (d->click_count > 0) {
+    // The click must be sent before it is reset, the reset itself can be coalesced.
     mgos_homeassistant_object_send_status(o);
     d->click_count = 0;
-    mgos_homeassistant_object_send_status(o);
+    mgos_homeassistant_object_mark_dirty(o);
   }
 
   // Reset state after timeout.
@@ -206,8 +207,8 @@ static bool mgos_homeassistant_gpio_momentary_fromjson(struct mgos_homeassistant
   json_scanf(val.ptr, val.len, "{invert:%B, debounce:%d, timeout:%d, pull:%Q}", &user_data->invert, &user_data->debounce_ms, &user_data->timeout_ms,
              &j_pull);
 
-  if (!(o = mgos_homeassistant_object_add(ha, object_name, COMPONENT_SENSOR, "\"value_template\": \"{{ value_json.action }}\"", momentary_stat,
-                                          user_data)))
+  if (!(o = mgos_homeassistant_object_add_static(ha, object_name, COMPONENT_SENSOR, "\"value_template\": \"{{ value_json.action }}\"",
+                                                 momentary_stat, user_data)))
     goto exit;
   o->pre_remove_cb = binary_sensor_pre_remove_cb;
 
@@ -260,7 +261,7 @@ static void toggle_button_cb(int gpio, void *user_data) {
   d = (struct mgos_homeassistant_gpio_binary_sensor *) o->user_data;
   if (!d || d->gpio != gpio) return;
 
-  mgos_homeassistant_object_send_status(o);
+  mgos_homeassistant_object_mark_dirty(o);
 }
 
 static bool mgos_homeassistant_gpio_toggle_fromjson(struct mgos_homeassistant *ha, const char *object_name, int gpio, struct json_token val) {
@@ -289,8 +290,8 @@ static bool mgos_homeassistant_gpio_toggle_fromjson(struct mgos_homeassistant *h
     pull = user_data->invert ? MGOS_GPIO_PULL_UP : MGOS_GPIO_PULL_DOWN;
   }
 
-  if (!(o = mgos_homeassistant_object_add(ha, object_name, COMPONENT_BINARY_SENSOR, "\"value_template\": \"{{ value_json.state }}\"", toggle_stat,
-                                          user_data)))
+  if (!(o = mgos_homeassistant_object_add_static(ha, object_name, COMPONENT_BINARY_SENSOR, "\"value_template\": \"{{ value_json.state }}\"",
+                                                 toggle_stat, user_data)))
     goto exit;
   o->pre_remove_cb = binary_sensor_pre_remove_cb;
 
@@ -341,7 +342,7 @@ static void switch_timer_cb(void *user_data) {
 
   mgos_gpio_toggle(d->gpio);
   compute_schedule_override(d);
-  mgos_homeassistant_object_send_status(o);
+  mgos_homeassistant_object_mark_dirty(o);
   d->timer = 0;
 }
 
@@ -377,7 +378,7 @@ static void switch_cmd_cb(struct mgos_homeassistant_object *o, const char *paylo
 
 exit:
   compute_schedule_override(d);
-  mgos_homeassistant_object_send_status(o);
+  mgos_homeassistant_object_mark_dirty(o);
   return;
 }
 
@@ -522,8 +523,8 @@ static bool mgos_homeassistant_gpio_switch_fromjson(struct mgos_homeassistant *h
   user_data->schedule_timer = 0;
   json_scanf(val.ptr, val.len, "{invert:%B}", &user_data->invert);
 
-  if (!(o = mgos_homeassistant_object_add(ha, object_name, COMPONENT_SWITCH, "\"value_template\":\"{{ value_json.state }}\"", switch_stat,
-                                          user_data)))
+  if (!(o = mgos_homeassistant_object_add_static(ha, object_name, COMPONENT_SWITCH, "\"value_template\":\"{{ value_json.state }}\"", switch_stat,
+                                                 user_data)))
     goto exit;
   mgos_homeassistant_object_add_cmd_cb(o, NULL, switch_cmd_cb);
   mgos_homeassistant_object_add_cmd_cb(o, "schedule", switch_cmd_schedule_cb);
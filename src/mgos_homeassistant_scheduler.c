@@ -0,0 +1,136 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mgos_homeassistant_scheduler.h"
+
+#include <stdlib.h>
+
+#define MGOS_HOMEASSISTANT_SCHEDULER_MAX_MS 3600000
+
+static void mgos_homeassistant_scheduler_swap(struct mgos_homeassistant_scheduler *s, int a, int b) {
+  struct mgos_homeassistant_deadline *dl = s->heap[a];
+  s->heap[a] = s->heap[b];
+  s->heap[b] = dl;
+  s->heap[a]->pos = a;
+  s->heap[b]->pos = b;
+}
+
+static void mgos_homeassistant_scheduler_up(struct mgos_homeassistant_scheduler *s, int i) {
+  while (i > 0 && s->heap[(i - 1) / 2]->at > s->heap[i]->at) {
+    mgos_homeassistant_scheduler_swap(s, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void mgos_homeassistant_scheduler_down(struct mgos_homeassistant_scheduler *s, int i) {
+  for (;;) {
+    int l = 2 * i + 1, r = l + 1, min = i;
+    if (l < s->len && s->heap[l]->at < s->heap[min]->at) min = l;
+    if (r < s->len && s->heap[r]->at < s->heap[min]->at) min = r;
+    if (min == i) return;
+    mgos_homeassistant_scheduler_swap(s, i, min);
+    i = min;
+  }
+}
+
+static void mgos_homeassistant_scheduler_remove(struct mgos_homeassistant_scheduler *s, struct mgos_homeassistant_deadline *dl) {
+  int i = dl->pos;
+
+  dl->pos = -1;
+  if (--s->len == i) return;
+  s->heap[i] = s->heap[s->len];
+  s->heap[i]->pos = i;
+  mgos_homeassistant_scheduler_up(s, i);
+  mgos_homeassistant_scheduler_down(s, i);
+}
+
+static void mgos_homeassistant_scheduler_timer_cb(void *arg);
+
+// Keeps the timer armed for the earliest deadline, if there is one.
+static void mgos_homeassistant_scheduler_arm(struct mgos_homeassistant_scheduler *s) {
+  double at, delay;
+
+  if (s->len == 0) {
+    if (s->timer) mgos_clear_timer(s->timer);
+    s->timer = 0;
+    return;
+  }
+  at = s->heap[0]->at;
+  if (s->timer && s->timer_at == at) return;
+  if (s->timer) mgos_clear_timer(s->timer);
+  // Far deadlines wake up early once in a while, rather than overflow the timer.
+  delay = (at - mgos_uptime()) * 1000;
+  if (delay > MGOS_HOMEASSISTANT_SCHEDULER_MAX_MS) delay = MGOS_HOMEASSISTANT_SCHEDULER_MAX_MS;
+  s->timer = mgos_set_timer(delay < 1 ? 1 : (int) delay, 0, mgos_homeassistant_scheduler_timer_cb, s);
+  s->timer_at = at;
+}
+
+static void mgos_homeassistant_scheduler_timer_cb(void *arg) {
+  struct mgos_homeassistant_scheduler *s = arg;
+  // Deadlines within a millisecond are due, the timer has that resolution.
+  double now = mgos_uptime() + 0.001;
+
+  s->timer = 0;
+  while (s->len > 0 && s->heap[0]->at <= now) {
+    struct mgos_homeassistant_deadline *dl = s->heap[0];
+    mgos_homeassistant_scheduler_remove(s, dl);
+    // The callback may schedule dl, or others, again.
+    dl->cb(dl, dl->user_data);
+  }
+  mgos_homeassistant_scheduler_arm(s);
+}
+
+struct mgos_homeassistant_scheduler *mgos_homeassistant_scheduler_create(void) {
+  return calloc(1, sizeof(struct mgos_homeassistant_scheduler));
+}
+
+void mgos_homeassistant_scheduler_destroy(struct mgos_homeassistant_scheduler **s) {
+  if (!s || !*s) return;
+  while ((*s)->len > 0) mgos_homeassistant_scheduler_remove(*s, (*s)->heap[0]);
+  if ((*s)->timer) mgos_clear_timer((*s)->timer);
+  if ((*s)->heap) free((*s)->heap);
+  free(*s);
+  *s = NULL;
+}
+
+bool mgos_homeassistant_scheduler_add(struct mgos_homeassistant_scheduler *s, struct mgos_homeassistant_deadline *dl, double at) {
+  if (!s || !dl || !dl->cb) return false;
+  if (dl->pos >= 0) {
+    dl->at = at;
+    mgos_homeassistant_scheduler_up(s, dl->pos);
+    mgos_homeassistant_scheduler_down(s, dl->pos);
+  } else {
+    if (s->len == s->size) {
+      int size = s->size ? s->size * 2 : 8;
+      struct mgos_homeassistant_deadline **heap = realloc(s->heap, size * sizeof(*heap));
+      if (!heap) return false;
+      s->heap = heap;
+      s->size = size;
+    }
+    dl->at = at;
+    dl->pos = s->len;
+    s->heap[s->len++] = dl;
+    mgos_homeassistant_scheduler_up(s, dl->pos);
+  }
+  mgos_homeassistant_scheduler_arm(s);
+  return true;
+}
+
+void mgos_homeassistant_scheduler_cancel(struct mgos_homeassistant_scheduler *s, struct mgos_homeassistant_deadline *dl) {
+  if (!s || !dl || dl->pos < 0) return;
+  mgos_homeassistant_scheduler_remove(s, dl);
+  mgos_homeassistant_scheduler_arm(s);
+}
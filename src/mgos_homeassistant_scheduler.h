@@ -0,0 +1,69 @@
+/*
+ * Copyright 2020 Pim van Pelt <pim@ipng.nl>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "mgos.h"
+#include "mgos_timers.h"
+
+/* A min-heap of deadlines for the whole node, driven by a single mgos timer
+ * that is armed for the earliest deadline only. Owners embed a struct
+ * mgos_homeassistant_deadline, so that scheduling allocates nothing beyond
+ * growing the heap, and cancelling is O(log n).
+ *
+ * static void blink_cb(struct mgos_homeassistant_deadline *dl, void *user_data) {
+ *   mgos_homeassistant_scheduler_add(s, dl, dl->at + 1.0);  // again in 1s
+ * }
+ *
+ * struct mgos_homeassistant_deadline dl = MGOS_HOMEASSISTANT_DEADLINE_INIT(blink_cb, NULL);
+ * mgos_homeassistant_scheduler_add(s, &dl, mgos_uptime() + 1.0);
+ * ...
+ * mgos_homeassistant_scheduler_cancel(s, &dl);
+ */
+
+struct mgos_homeassistant_deadline;
+typedef void (*mgos_homeassistant_deadline_cb)(struct mgos_homeassistant_deadline *dl, void *user_data);
+
+struct mgos_homeassistant_deadline {
+  double at;  // mgos_uptime() at which cb runs
+  int pos;    // position in the heap, -1 if not scheduled
+  mgos_homeassistant_deadline_cb cb;
+  void *user_data;
+};
+
+#define MGOS_HOMEASSISTANT_DEADLINE_INIT(cb, user_data) \
+  { 0, -1, (cb), (user_data) }
+
+struct mgos_homeassistant_scheduler {
+  struct mgos_homeassistant_deadline **heap;
+  int len;
+  int size;
+  mgos_timer_id timer;
+  double timer_at;  // deadline the timer is armed for
+};
+
+struct mgos_homeassistant_scheduler *mgos_homeassistant_scheduler_create(void);
+void mgos_homeassistant_scheduler_destroy(struct mgos_homeassistant_scheduler **s);
+
+// Schedules dl to run at uptime at, moving it if it is scheduled already.
+bool mgos_homeassistant_scheduler_add(struct mgos_homeassistant_scheduler *s, struct mgos_homeassistant_deadline *dl, double at);
+void mgos_homeassistant_scheduler_cancel(struct mgos_homeassistant_scheduler *s, struct mgos_homeassistant_deadline *dl);
+
+static inline bool mgos_homeassistant_deadline_pending(const struct mgos_homeassistant_deadline *dl) {
+  return dl->pos >= 0;
+}
@@ -91,11 +91,11 @@ bool mgos_homeassistant_si7021_fromjson(struct mgos_homeassistant *ha, struct js
   }
   o->pre_remove_cb = si7021_pre_remove_cb;
 
-  if (!mgos_homeassistant_object_class_add(o, "humidity", "\"unit_of_measurement\":\"%\"", si7021_stat_humidity)) {
+  if (!mgos_homeassistant_object_class_add_static(o, "humidity", "\"unit_of_measurement\":\"%\"", si7021_stat_humidity)) {
     LOG(LL_ERROR, ("Could not add 'humidity' class to object %s", nameptr));
     goto exit;
   }
-  if (!mgos_homeassistant_object_class_add(o, "temperature", "\"unit_of_measurement\":\"°C\"", si7021_stat_temperature)) {
+  if (!mgos_homeassistant_object_class_add_static(o, "temperature", "\"unit_of_measurement\":\"°C\"", si7021_stat_temperature)) {
     LOG(LL_ERROR, ("Could not add 'temperature' class to object %s", nameptr));
     goto exit;
   }